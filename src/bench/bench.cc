@@ -0,0 +1,411 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+/* Headless benchmark of the virtual terminal input parser.
+ *
+ * Replays recorded byte streams through Vterm, without involving a pty,
+ * an X11 window or an OpenGL context, and reports the achieved
+ * throughput as well as the number of heap allocations made while
+ * processing the input. Pty sessions recorded with zutty -record are
+ * replayed with their original reads and resizes, optionally printing
+ * a checksum of the screen contents after each refresh.
+ */
+
+#include "options.h"
+#include "record.h"
+#include "vterm.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+   using namespace zutty;
+
+   std::atomic <uint64_t> allocCount {0};
+
+   bool printHashes = false; // -hashes
+   bool timedReplay = false; // -timed
+
+   void
+   usage ()
+   {
+      std::cout
+         << "Usage: zutty-bench [-option ...] [reps] <stream> ...\n\n"
+         << "Replay each stream reps times (default: 10) through the\n"
+         << "terminal input parser and report its throughput.\n\n"
+         << "Streams:\n"
+         << "  <file>     Recorded output; decompressed if named *.gz\n"
+         << "             (or a pty session recorded with zutty -record)\n"
+         << "  -          Read recorded output from stdin\n"
+         << "  @sgr       Synthetic stream of truecolor SGR sequences\n\n"
+         << "Replay options (for sessions recorded with -record):\n"
+         << "  -hashes    Print a checksum of the screen after each refresh\n"
+         << "  -timed     Replay at the original pace instead of full speed\n\n"
+         << "Options as for zutty (e.g., -geometry, -saveLines).\n"
+         << std::endl;
+   }
+
+   bool
+   readFile (const std::string& path, std::string& data)
+   {
+      if (path == "-")
+      {
+         data.assign (std::istreambuf_iterator <char> (std::cin),
+                      std::istreambuf_iterator <char> ());
+         return true;
+      }
+
+      if (path.size () > 3 && path.compare (path.size () - 3, 3, ".gz") == 0)
+      {
+         // Run gzip directly, so the path is never seen by a shell
+         int fds [2];
+         if (pipe (fds) < 0)
+            return false;
+         pid_t pid = fork ();
+         if (pid < 0)
+         {
+            close (fds [0]);
+            close (fds [1]);
+            return false;
+         }
+         if (pid == 0)
+         {
+            dup2 (fds [1], STDOUT_FILENO);
+            close (fds [0]);
+            close (fds [1]);
+            execlp ("gzip", "gzip", "-dc", "--", path.c_str (), nullptr);
+            _exit (127);
+         }
+         close (fds [1]);
+         char buf [65536];
+         ssize_t n;
+         while ((n = read (fds [0], buf, sizeof (buf))) != 0)
+         {
+            if (n < 0 && errno == EINTR)
+               continue;
+            if (n < 0)
+               break;
+            data.append (buf, n);
+         }
+         close (fds [0]);
+         int status;
+         while (waitpid (pid, &status, 0) < 0 && errno == EINTR)
+            ;
+         return n == 0 && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+      }
+
+      std::ifstream ifs (path, std::ios::binary);
+      if (!ifs)
+         return false;
+      data.assign (std::istreambuf_iterator <char> (ifs),
+                   std::istreambuf_iterator <char> ());
+      return true;
+   }
+
+   // Lines of short words, each with its own truecolor fg and bg
+   void
+   makeSgrStream (std::string& data)
+   {
+      uint32_t seed = 1;
+      auto rnd = [&seed] (int n)
+                 {
+                    seed = seed * 1103515245 + 12345;
+                    return (int)((seed >> 16) % n);
+                 };
+
+      char buf [64];
+      while (data.size () < 4 * 1024 * 1024)
+      {
+         for (int w = 0; w < 8; ++w)
+         {
+            snprintf (buf, sizeof (buf), "\e[38;2;%d;%d;%dm\e[48;2;%d;%d;%dm",
+                      rnd (256), rnd (256), rnd (256),
+                      rnd (256), rnd (256), rnd (256));
+            data += buf;
+            int len = 2 + rnd (7);
+            for (int k = 0; k < len; ++k)
+               data += (char)('a' + rnd (26));
+            data += "\e[0m ";
+         }
+         data += "\r\n";
+      }
+   }
+
+   void
+   printResult (const std::string& name, double bytes, double secs,
+                uint64_t allocs)
+   {
+      const double mib = bytes / (1024 * 1024);
+
+      std::cout << std::left << std::setw (24) << name << std::right
+                << std::fixed << std::setprecision (2)
+                << std::setw (10) << mib
+                << std::setw (12) << mib / secs
+                << std::setw (10) << secs * 1e9 / bytes
+                << std::setw (12) << allocs / mib
+                << std::endl;
+   }
+
+   // FNV-1a over what is shown in each visible cell. Only the contents
+   // are hashed (not the memory layout of cells), so that checksums stay
+   // comparable across changes to the representation.
+   uint64_t
+   hashFrame (const Frame& frame)
+   {
+      uint64_t h = 14695981039346656037ull;
+      auto mix = [&h] (uint32_t v)
+                 {
+                    for (int k = 0; k < 4; ++k, v >>= 8)
+                       h = (h ^ (v & 0xff)) * 1099511628211ull;
+                 };
+
+      std::vector <CharVdev::Cell> row (frame.nCols);
+      mix (frame.nCols);
+      mix (frame.nRows);
+      for (uint16_t pY = 0; pY < frame.nRows; ++pY)
+      {
+         frame.copyViewRow (pY, row.data ());
+         for (const auto& c: row)
+         {
+            mix (c.uc_pt);
+            mix (c.dwidth | c.dwidth_cont << 1 | c.bold << 2 |
+                 c.italic << 3 | c.underline << 4 | c.inverse << 5 |
+                 c.wrap << 6);
+            const Color fg = resolveColor (c.fg);
+            const Color bg = resolveColor (c.bg);
+            mix (fg.red << 16 | fg.green << 8 | fg.blue);
+            mix (bg.red << 16 | bg.green << 8 | bg.blue);
+         }
+      }
+      return h;
+   }
+
+   // Recordings contain resizes, which the terminal passes on to its
+   // pty, so replay into one (with no process behind it). Terminal
+   // responses go to its slave side, from where they are discarded.
+   int
+   openPty (int& slaveFd)
+   {
+      int fd = posix_openpt (O_RDWR | O_NOCTTY | O_NONBLOCK);
+      if (fd < 0 || grantpt (fd) < 0 || unlockpt (fd) < 0 ||
+          (slaveFd = open (ptsname (fd), O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0)
+      {
+         std::cerr << "Cannot open pty: " << strerror (errno) << std::endl;
+         exit (1);
+      }
+      return fd;
+   }
+
+   void
+   discardInput (int fd)
+   {
+      char buf [4096];
+      while (read (fd, buf, sizeof (buf)) > 0)
+         ;
+   }
+
+   // Replay a session recorded with -record, from a fresh terminal of the
+   // recorded initial size on each repetition
+   void
+   runRecording (const std::string& name, const std::string& data, int reps)
+   {
+      uint16_t cols, rows;
+      std::vector <record::Event> events;
+      if (!record::load (data, cols, rows, events))
+         std::cerr << name << ": recording truncated or corrupt, "
+                   << "replaying the " << events.size ()
+                   << " events before that" << std::endl;
+
+      size_t inputBytes = 0;
+      for (const auto& ev: events)
+         inputBytes += ev.data.size ();
+
+      auto winSize = [] (uint16_t n) { return n + 2 * opts.border; };
+      int slaveFd;
+      int ptyFd = openPty (slaveFd);
+      uint64_t allocs = 0;
+      double secs = 0;
+      for (int r = 0; r < reps; ++r)
+      {
+         Vterm vt (1, 1, winSize (cols), winSize (rows), ptyFd);
+         uint64_t nFrame = 0;
+         if (printHashes && r == 0)
+            vt.setRefreshHandler (
+               [&nFrame] (const Frame& f)
+               {
+                  std::cout << "frame " << std::setw (6) << ++nFrame << " "
+                            << std::hex << std::setfill ('0')
+                            << std::setw (16) << hashFrame (f)
+                            << std::dec << std::setfill (' ') << std::endl;
+               });
+         else
+            vt.setRefreshHandler ([] (const Frame&) {});
+
+         uint64_t allocs0 = allocCount;
+         auto t0 = std::chrono::steady_clock::now ();
+         for (const auto& ev: events)
+         {
+            if (timedReplay)
+               std::this_thread::sleep_until (
+                  t0 + std::chrono::microseconds (ev.usecs));
+
+            if (ev.kind == record::Resize)
+               vt.resize (winSize (ev.cols), winSize (ev.rows));
+            else
+               vt.processInput ((const unsigned char*) ev.data.data (),
+                                ev.data.size ());
+            discardInput (slaveFd);
+            vt.flushOutput ();
+         }
+         auto t1 = std::chrono::steady_clock::now ();
+         allocs += allocCount - allocs0;
+         secs += std::chrono::duration <double> (t1 - t0).count ();
+      }
+      close (slaveFd);
+      close (ptyFd);
+
+      printResult (name, (double) inputBytes * reps, secs, allocs);
+   }
+
+   void
+   runStream (const std::string& name, const std::string& data, int reps)
+   {
+      // Terminal responses (e.g., to DA or DSR queries) are discarded.
+      int devNull = open ("/dev/null", O_WRONLY);
+      Vterm vt (1, 1,
+                opts.nCols + 2 * opts.border, opts.nRows + 2 * opts.border,
+                devNull);
+      vt.setRefreshHandler ([] (const Frame&) {});
+
+      // Feed the data in chunks as large as a single read from the pty
+      const size_t chunkSize = 32 * 1024;
+      const auto* input = (const unsigned char*) data.data ();
+
+      uint64_t allocs0 = allocCount;
+      auto t0 = std::chrono::steady_clock::now ();
+      for (int r = 0; r < reps; ++r)
+         for (size_t pos = 0; pos < data.size (); pos += chunkSize)
+            vt.processInput (input + pos,
+                             std::min (chunkSize, data.size () - pos));
+      auto t1 = std::chrono::steady_clock::now ();
+      uint64_t allocs = allocCount - allocs0;
+
+      close (devNull);
+
+      const double secs = std::chrono::duration <double> (t1 - t0).count ();
+      printResult (name, (double) data.size () * reps, secs, allocs);
+   }
+
+} // namespace
+
+// Count heap allocations made by the code under test
+void*
+operator new (size_t size)
+{
+   ++allocCount;
+   if (void* p = malloc (size ? size : 1))
+      return p;
+   throw std::bad_alloc ();
+}
+
+void
+operator delete (void* p) noexcept
+{
+   free (p);
+}
+
+void
+operator delete (void* p, size_t) noexcept
+{
+   free (p);
+}
+
+int
+main (int argc, char* argv[])
+{
+   setlocale (LC_ALL, ""); // as zutty does, for the widths of characters
+   opts.initialize (&argc, argv);
+   opts.parse ();
+   opts.quiet = !opts.verbose; // keep unhandled input reports out
+
+   int argp = 1;
+   for (; argp < argc && argv [argp][0] == '-' && argv [argp][1]; ++argp)
+      if (strcmp (argv [argp], "-hashes") == 0)
+         printHashes = true;
+      else if (strcmp (argv [argp], "-timed") == 0)
+         timedReplay = true;
+      else
+      {
+         std::cerr << "Unknown option: " << argv [argp] << std::endl;
+         return 1;
+      }
+
+   int reps = 10;
+   if (argp < argc && isdigit (argv [argp][0]))
+      reps = std::max (1, atoi (argv [argp++]));
+
+   if (argp == argc)
+   {
+      usage ();
+      return 1;
+   }
+
+   std::cout << std::left << std::setw (24) << "stream" << std::right
+             << std::setw (10) << "MiB"
+             << std::setw (12) << "MiB/s"
+             << std::setw (10) << "ns/byte"
+             << std::setw (12) << "allocs/MiB"
+             << std::endl;
+
+   int rc = 0;
+   for (; argp < argc; ++argp)
+   {
+      std::string name = argv [argp];
+      std::string data;
+      if (name == "@sgr")
+         makeSgrStream (data);
+      else if (!readFile (name, data) || data.empty ())
+      {
+         std::cerr << "Cannot read stream: " << name << std::endl;
+         rc = 1;
+         continue;
+      }
+
+      auto slash = name.find_last_of ('/');
+      if (slash != std::string::npos)
+         name = name.substr (slash + 1);
+      if (record::isRecording (data))
+         runRecording (name, data, reps);
+      else
+         runStream (name, data, reps);
+   }
+   return rc;
+}
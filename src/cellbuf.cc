@@ -0,0 +1,220 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#include "cellbuf.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace
+{
+   using Cell = zutty::CharVdev::Cell;
+
+   constexpr const size_t hugePageSize = 2 << 20;
+
+   // Cells filled per copy at most, keeping the source in the L1 cache
+   constexpr const size_t maxFillCopy = 1024;
+
+   // Cells filled one by one at the start, where copies would stall on
+   // the stores just made
+   constexpr const size_t fillPrefix = 64;
+
+   // Cells set per step by refill
+   constexpr const size_t refillBlock = 8;
+
+   // Mappings given back, kept to be reused. Two of them cover a frame
+   // being replaced by one of (nearly) the same size, for each screen.
+   constexpr const size_t maxPooled = 2;
+
+   // A pooled mapping is only reused for a buffer needing at least this
+   // fraction of it, lest a small buffer keep a large mapping alive
+   constexpr const size_t maxPoolSlack = 2;
+
+   struct Mapping
+   {
+      void* addr;
+      size_t size;
+   };
+
+   std::mutex poolMx;
+   std::vector <Mapping> pool;
+
+   size_t
+   roundUp (size_t n, size_t align)
+   {
+      return (n + align - 1) / align * align;
+   }
+
+   // A new mapping of size bytes. Huge pages can only back the parts of a
+   // mapping aligned to their size, so if they are to be used, more is
+   // mapped than needed, and trimmed to an aligned start and end.
+   void*
+   mapMemory (size_t size, bool huge)
+   {
+      const size_t mapped = huge ? size + hugePageSize : size;
+      void* addr = mmap (nullptr, mapped, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANON, -1, 0);
+      if (addr == MAP_FAILED)
+         throw std::bad_alloc ();
+      if (!huge)
+         return addr;
+
+      uint8_t* start = (uint8_t*) addr;
+      uint8_t* aligned = (uint8_t*) roundUp ((uintptr_t) start, hugePageSize);
+      if (aligned > start)
+         munmap (start, aligned - start);
+      const size_t tail = mapped - (aligned - start) - size;
+      if (tail)
+         munmap (aligned + size, tail);
+#ifdef MADV_HUGEPAGE
+      madvise (aligned, size, MADV_HUGEPAGE);
+#endif
+      return aligned;
+   }
+
+} // namespace
+
+namespace zutty
+{
+   CellBuffer::CellBuffer (size_t count)
+   {
+      static const size_t pageSize = sysconf (_SC_PAGESIZE);
+      const size_t bytes = count * sizeof (Cell);
+      const bool huge = bytes >= hugePageSize;
+      const size_t needed = roundUp (bytes, huge ? hugePageSize : pageSize);
+
+      Mapping oversized = {nullptr, 0};
+      {
+         // The smallest pooled mapping that fits, unless it is way larger
+         // than needed: then it is given up instead
+         std::lock_guard <std::mutex> lock (poolMx);
+         auto it = pool.end ();
+         for (auto p = pool.begin (); p != pool.end (); ++p)
+            if (p->size >= bytes && (it == pool.end () || p->size < it->size))
+               it = p;
+         if (it != pool.end ())
+         {
+            if (it->size <= maxPoolSlack * needed)
+            {
+               cells = (Cell*) it->addr;
+               mapSize = it->size;
+            }
+            else
+               oversized = *it;
+            pool.erase (it);
+         }
+      }
+      if (oversized.addr)
+         munmap (oversized.addr, oversized.size);
+
+      if (!cells)
+      {
+         mapSize = needed;
+         cells = (Cell*) mapMemory (mapSize, huge);
+      }
+
+      fill (cells, count, Cell ());
+   }
+
+   CellBuffer::CellBuffer (CellBuffer&& rhs)
+      : cells (rhs.cells)
+      , mapSize (rhs.mapSize)
+   {
+      rhs.cells = nullptr;
+      rhs.mapSize = 0;
+   }
+
+   CellBuffer&
+   CellBuffer::operator = (CellBuffer&& rhs)
+   {
+      if (this != &rhs)
+      {
+         reset ();
+         std::swap (cells, rhs.cells);
+         std::swap (mapSize, rhs.mapSize);
+      }
+      return *this;
+   }
+
+   void
+   CellBuffer::reset ()
+   {
+      if (!cells)
+         return;
+
+      Mapping evicted = {cells, mapSize};
+      {
+         std::lock_guard <std::mutex> lock (poolMx);
+         pool.push_back (evicted);
+         evicted = {nullptr, 0};
+         if (pool.size () > maxPooled)
+         {
+            evicted = pool.front ();
+            pool.erase (pool.begin ());
+         }
+      }
+      if (evicted.addr)
+         munmap (evicted.addr, evicted.size);
+
+      cells = nullptr;
+      mapSize = 0;
+   }
+
+   void
+   CellBuffer::fill (Cell* dst, size_t count, const Cell& cell)
+   {
+      if (!count)
+         return;
+
+      size_t done = std::min (count, fillPrefix);
+      std::fill (dst, dst + done, cell);
+      while (done < count)
+      {
+         const size_t n = std::min ({done, count - done, maxFillCopy});
+         memcpy (dst + done, dst, n * sizeof (Cell));
+         done += n;
+      }
+   }
+
+   bool
+   CellBuffer::refill (Cell* dst, size_t count, const Cell& cell)
+   {
+      static_assert (sizeof (Cell) == sizeof (uint64_t), "Cell size");
+      uint64_t ref [refillBlock];
+      memcpy (&ref [0], &cell, sizeof (Cell));
+      std::fill (ref + 1, ref + refillBlock, ref [0]);
+
+      uint64_t diff = 0;
+      size_t n = 0;
+      for (; n + refillBlock <= count; n += refillBlock)
+      {
+         uint64_t block [refillBlock];
+         memcpy (block, dst + n, sizeof (block));
+         for (size_t k = 0; k < refillBlock; ++k)
+            diff |= block [k] ^ ref [k];
+         memcpy (dst + n, ref, sizeof (ref));
+      }
+      for (; n < count; ++n)
+      {
+         diff |= dst [n] != cell;
+         dst [n] = cell;
+      }
+      return diff != 0;
+   }
+
+} // namespace zutty
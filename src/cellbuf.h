@@ -0,0 +1,70 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#pragma once
+
+#include "charvdev.h"
+
+#include <cstddef>
+
+namespace zutty
+{
+   /* The cells of a Frame (its screen and the rows of history kept in
+    * cells), owned by that frame alone.
+    *
+    * The memory is mapped page-aligned, and huge pages are asked for if
+    * the buffer is large enough to use them. On release, the mapping is
+    * kept in a small pool, to be reused by the next buffer that fits in
+    * it without leaving most of it unused: the frame of a resize, or the
+    * alternate screen set up anew each time it is switched to. A buffer
+    * obtained from the pool has its pages already faulted in.
+    */
+   class CellBuffer
+   {
+   public:
+      using Cell = CharVdev::Cell;
+
+      CellBuffer () = default;
+
+      // A buffer of count cells, each set to a default (blank) cell
+      explicit CellBuffer (size_t count);
+
+      ~CellBuffer () { reset (); }
+
+      CellBuffer (CellBuffer&& rhs);
+      CellBuffer& operator = (CellBuffer&& rhs);
+
+      CellBuffer (const CellBuffer&) = delete;
+      CellBuffer& operator = (const CellBuffer&) = delete;
+
+      Cell* get () const { return cells; }
+      explicit operator bool () const { return cells != nullptr; }
+
+      // Give back the memory (to the pool); the buffer is empty thereafter
+      void reset ();
+
+      // Set count cells from dst onwards to cell. Short runs (most lines
+      // erased) are filled directly; beyond that, by doubling copies of
+      // what is already filled, which get vectorized, unlike a loop
+      // assigning the cells (bit fields and all) one by one.
+      static void fill (Cell* dst, size_t count, const Cell& cell);
+
+      // Like fill, but return whether any of the cells were different
+      // before. Done in blocks of cells, each compared and then set in a
+      // single pass, which gets vectorized as well.
+      static bool refill (Cell* dst, size_t count, const Cell& cell);
+
+   private:
+      Cell* cells = nullptr;
+      size_t mapSize = 0; // bytes mapped, zero if cells is null
+   };
+
+} // namespace zutty
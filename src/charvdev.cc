@@ -12,16 +12,22 @@
 #include "charvdev.h"
 #include "log.h"
 #include "options.h"
+#include "stats.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 namespace
 {
-   static const char *computeShaderSource = R"(#version 310 es
-
-layout (local_size_x = 1, local_size_y = 1) in;
+   // Declarations and functions shared by both variants of the compute
+   // shader, each of which only maps its invocations to cells and pixels
+   static const char *computeShaderCommon = R"(
 layout (rgba32f, binding = 0) writeonly lowp uniform image2D imgOut;
 layout (binding = 1) uniform lowp sampler2DArray atlas;
 layout (binding = 2) uniform lowp sampler2D atlasMap;
@@ -38,73 +44,98 @@ uniform highp ivec2 selectDamage;
 uniform lowp int deltaFrame;
 uniform lowp int showWraps;
 uniform lowp int hasDoubleWidth;
+uniform lowp ivec2 originChars;
 
 struct Cell
 {
    highp uint charData;
-   highp uint fg;
-   highp uint bg;
+   highp uint colors; // codes of fg (low half) and bg in the color table
 };
 
-layout (std430, binding = 0) buffer CharVideoMem
+layout (std430, binding = 0) readonly buffer CharVideoMem
 {
    Cell cells[];
 } vmem;
 
-void main ()
+layout (std430, binding = 1) readonly buffer DirtyMask
 {
-   ivec2 charPos = ivec2 (gl_GlobalInvocationID.xy);
-   int idx = sizeChars.x * charPos.y + charPos.x;
-   Cell cell = vmem.cells[idx];
+   highp uint bits[];
+} dmask;
 
-   if (deltaFrame == 1)
-   {
-      uint dirty = bitfieldExtract (cell.charData, 23, 1);
-      if (dirty == 0u &&
-          charPos != cursorPos.xy && charPos != cursorPos.zw &&
-          (idx < selectDamage.x || idx >= selectDamage.y))
-         return;
-   }
-   vmem.cells[idx].charData = bitfieldInsert (cell.charData, 0u, 23, 1);
+layout (std430, binding = 2) readonly buffer ColorTable
+{
+   highp uint rgb[];
+} ctab;
+
+vec3 getColor (uint code)
+{
+   uint rgb = ctab.rgb[code];
+   return vec3 (float (bitfieldExtract (rgb, 0, 8)),
+                float (bitfieldExtract (rgb, 8, 8)),
+                float (bitfieldExtract (rgb, 16, 8))) / 255.0;
+}
+
+// Whether the cell at idx is to be drawn again (not just in a delta frame)
+bool isDamaged (int idx, ivec2 charPos)
+{
+   if (deltaFrame == 0)
+      return true;
+
+   uint dirty = bitfieldExtract (dmask.bits[idx >> 5], idx & 31, 1);
+   return dirty == 1u ||
+      charPos == cursorPos.xy || charPos == cursorPos.zw ||
+      (idx >= selectDamage.x && idx < selectDamage.y);
+}
+
+// Everything about a cell needed to shade its pixels
+struct Shading
+{
+   ivec2 atlasPos;
+   uint fontIdx; // 0 -> Normal; 1 -> Bold; 2 -> Italic; 3 -> BoldItalic
+   uint dwidth;
+   uint underline;
+   uint wrap;
+   bool cursorBox;
+   vec3 fgColor;
+   vec3 bgColor;
+   vec3 crColor;
+   ivec2 srcGlyphPixels; // size of the cell's glyph (both halves if dwidth)
+};
+
+// Decode the cell at idx (not a double-width continuation) for shading
+Shading shadeCell (Cell cell, int idx, ivec2 charPos)
+{
+   Shading s;
 
    ivec2 charCode =
       ivec2 (bitfieldExtract (cell.charData, 0, 8),  // Lowest byte
              bitfieldExtract (cell.charData, 8, 8)); // Next-lowest byte
 
-   uint dwidth = bitfieldExtract (cell.charData, 16, 1);
-   uint dwidth_cont = bitfieldExtract (cell.charData, 17, 1);
-   if (dwidth_cont == 1u) // double-width cell continuation - drawn by left half
-      return;
-
-   if (dwidth == 1u && charPos.x < sizeChars.x - 1)
+   s.dwidth = bitfieldExtract (cell.charData, 16, 1);
+   if (s.dwidth == 1u && charPos.x < sizeChars.x - 1)
    {
       // check validity (dwidth_cont marker in the cell to the right)
       if (bitfieldExtract (vmem.cells[idx + 1].charData, 17, 1) != 1u)
-         dwidth = 0u;
+         s.dwidth = 0u;
    }
 
-   uint fontIdx = 0u; // 0 -> Normal; 1 -> Bold; 2 -> Italic; 3 -> BoldItalic
-   if (dwidth == 0u)
-      fontIdx = bitfieldExtract (cell.charData, 18, 2);
-   uint underline = bitfieldExtract (cell.charData, 20, 1);
+   s.fontIdx = 0u;
+   if (s.dwidth == 0u)
+      s.fontIdx = bitfieldExtract (cell.charData, 18, 2);
+   s.underline = bitfieldExtract (cell.charData, 20, 1);
    uint inverse = bitfieldExtract (cell.charData, 21, 1);
-   uint wrap = bitfieldExtract (cell.charData, 22, 1);
+   s.wrap = bitfieldExtract (cell.charData, 22, 1);
 
-   ivec2 atlasPos;
-   if (dwidth == 0u)
-      atlasPos = ivec2 (vec2 (256) * texelFetch (atlasMap, charCode, 0).zw);
+   if (s.dwidth == 0u)
+      s.atlasPos = ivec2 (vec2 (256) * texelFetch (atlasMap, charCode, 0).zw);
    else
-      atlasPos = ivec2 (vec2 (256) * texelFetch (atlasMap_dw, charCode, 0).zw);
+      s.atlasPos =
+         ivec2 (vec2 (256) * texelFetch (atlasMap_dw, charCode, 0).zw);
 
-   vec3 fgColor = vec3 (float (bitfieldExtract (cell.fg, 0, 8)),
-                        float (bitfieldExtract (cell.fg, 8, 8)),
-                        float (bitfieldExtract (cell.fg, 16, 8))) / 255.0;
+   s.fgColor = getColor (bitfieldExtract (cell.colors, 0, 16));
+   s.bgColor = getColor (bitfieldExtract (cell.colors, 16, 16));
 
-   vec3 bgColor = vec3 (float (bitfieldExtract (cell.bg, 0, 8)),
-                        float (bitfieldExtract (cell.bg, 8, 8)),
-                        float (bitfieldExtract (cell.bg, 16, 8))) / 255.0;
-
-   vec3 crColor = vec3 (cursorColor) / 255.0;
+   s.crColor = vec3 (cursorColor) / 255.0;
 
    if (selectRectMode == 1)
    {
@@ -121,113 +152,143 @@ void main ()
 
    if (inverse == 1u)
    {
-      vec3 tmp = fgColor;
-      fgColor = bgColor;
-      bgColor = tmp;
+      vec3 tmp = s.fgColor;
+      s.fgColor = s.bgColor;
+      s.bgColor = tmp;
    }
-   if (crColor == bgColor)
+   if (s.crColor == s.bgColor)
    {
-      crColor = vec3 (1.0) - crColor;
+      s.crColor = vec3 (1.0) - s.crColor;
    }
    if (charPos == cursorPos.xy && cursorStyle == 1)
    {
-      fgColor = bgColor;
-      bgColor = crColor;
+      s.fgColor = s.bgColor;
+      s.bgColor = s.crColor;
    }
+   s.cursorBox = charPos == cursorPos.xy && cursorStyle == 2;
+
+   s.srcGlyphPixels = glyphPixels;
+   if (s.dwidth == 1u)
+      s.srcGlyphPixels = ivec2 (2, 1) * glyphPixels;
 
-   ivec2 srcGlyphPixels = glyphPixels;
-   if (dwidth == 1u)
-      srcGlyphPixels = ivec2 (2, 1) * glyphPixels;
+   return s;
+}
 
-   if (dwidth == 0u)
+// The pixel at glyphPos (within s.srcGlyphPixels) of a cell
+vec4 shadePixel (Shading s, ivec2 glyphPos)
+{
+   vec4 pixel;
+   if (s.dwidth == 0u)
    {  // render regular cell
-      for (int j = 0; j < glyphPixels.x; j++)
-      {
-         for (int k = 0; k < glyphPixels.y; k++)
-         {
-            ivec2 txCoords = atlasPos * srcGlyphPixels + ivec2 (j, k);
-            ivec3 txc = ivec3 (txCoords, fontIdx);
-            vec3 glyph = texelFetch (atlas, txc, 0).rgb;
-            vec4 pixel = vec4 (fgColor * glyph + bgColor * (1.0 - glyph), 1.0);
-            ivec2 pxCoords = charPos * glyphPixels + ivec2 (j, k);
-            imageStore (imgOut, pxCoords, pixel);
-         }
-      }
+      ivec3 txc = ivec3 (s.atlasPos * s.srcGlyphPixels + glyphPos, s.fontIdx);
+      vec3 glyph = texelFetch (atlas, txc, 0).rgb;
+      pixel = vec4 (s.fgColor * glyph + s.bgColor * (1.0 - glyph), 1.0);
    }
    else if (hasDoubleWidth == 1)
    {  // render double-width cell
-      for (int j = 0; j < srcGlyphPixels.x; j++)
-      {
-         for (int k = 0; k < srcGlyphPixels.y; k++)
-         {
-            ivec2 txCoords = atlasPos * srcGlyphPixels + ivec2 (j, k);
-            ivec3 txc = ivec3 (txCoords, fontIdx);
-            vec3 glyph = texelFetch (atlas_dw, txc, 0).rgb;
-            vec4 pixel = vec4 (fgColor * glyph + bgColor * (1.0 - glyph), 1.0);
-            ivec2 pxCoords = charPos * glyphPixels + ivec2 (j, k);
-            imageStore (imgOut, pxCoords, pixel);
-         }
-      }
+      ivec3 txc = ivec3 (s.atlasPos * s.srcGlyphPixels + glyphPos, s.fontIdx);
+      vec3 glyph = texelFetch (atlas_dw, txc, 0).rgb;
+      pixel = vec4 (s.fgColor * glyph + s.bgColor * (1.0 - glyph), 1.0);
    }
    else
    {  // no double-width font -- draw an empty box
-      for (int j = 0; j < srcGlyphPixels.x; j++)
-      {
-         for (int k = 0; k < srcGlyphPixels.y; k++)
-         {
-            float lumi = 0.0;
-            if ((0 < j && j < srcGlyphPixels.x - 1) &&
-                (0 < k && k < srcGlyphPixels.y - 1) &&
-                (j == 1 || j == srcGlyphPixels.x - 2 ||
-                 k == 1 || k == srcGlyphPixels.y - 2))
-               lumi = 0.7;
-            vec4 pixel = vec4 (fgColor * lumi + bgColor * (1.0 - lumi), 1.0);
-            ivec2 pxCoords = charPos * glyphPixels + ivec2 (j, k);
-            imageStore (imgOut, pxCoords, pixel);
-         }
-      }
+      int j = glyphPos.x;
+      int k = glyphPos.y;
+      float lumi = 0.0;
+      if ((0 < j && j < s.srcGlyphPixels.x - 1) &&
+          (0 < k && k < s.srcGlyphPixels.y - 1) &&
+          (j == 1 || j == s.srcGlyphPixels.x - 2 ||
+           k == 1 || k == s.srcGlyphPixels.y - 2))
+         lumi = 0.7;
+      pixel = vec4 (s.fgColor * lumi + s.bgColor * (1.0 - lumi), 1.0);
    }
 
-   if (underline == 1u)
-   {
-      for (int j = 0; j < srcGlyphPixels.x; j++)
-      {
-         vec4 pixel = vec4 (fgColor, 1.0);
-         ivec2 pxCoords = charPos * glyphPixels +
-                          ivec2 (j, srcGlyphPixels.y - 1);
-         imageStore (imgOut, pxCoords, pixel);
-      }
-   }
+   if (s.underline == 1u && glyphPos.y == s.srcGlyphPixels.y - 1)
+      pixel = vec4 (s.fgColor, 1.0);
+
+   if (showWraps == 1 && s.wrap == 1u &&
+       glyphPos.x == s.srcGlyphPixels.x - 1 && glyphPos.y % 2 == 0)
+      pixel = vec4 (s.fgColor, 1.0);
+
+   if (s.cursorBox &&
+       (glyphPos.x == 0 || glyphPos.x == s.srcGlyphPixels.x - 1 ||
+        glyphPos.y == 0 || glyphPos.y == s.srcGlyphPixels.y - 1))
+      pixel = vec4 (s.crColor, 1.0);
+
+   return pixel;
+}
+)";
+
+   // One invocation per cell, rendering all pixels of the glyph
+   static const char *computeShaderCell = R"(#version 310 es
+
+layout (local_size_x = 1, local_size_y = 1) in;
+)";
 
-   if (showWraps == 1 && wrap == 1u)
+   static const char *computeShaderCellMain = R"(
+void main ()
+{
+   ivec2 charPos = originChars + ivec2 (gl_GlobalInvocationID.xy);
+   int idx = sizeChars.x * charPos.y + charPos.x;
+   Cell cell = vmem.cells[idx];
+
+   if (!isDamaged (idx, charPos))
+      return;
+
+   uint dwidth_cont = bitfieldExtract (cell.charData, 17, 1);
+   if (dwidth_cont == 1u) // double-width cell continuation - drawn by left half
+      return;
+
+   Shading s = shadeCell (cell, idx, charPos);
+   for (int j = 0; j < s.srcGlyphPixels.x; j++)
    {
-      vec4 pixel = vec4 (fgColor, 1.0);
-      for (int k = 0; k < srcGlyphPixels.y; k += 2)
+      for (int k = 0; k < s.srcGlyphPixels.y; k++)
       {
-         ivec2 pxCoords = charPos * glyphPixels +
-                          ivec2 (srcGlyphPixels.x - 1, k);
-         imageStore (imgOut, pxCoords, pixel);
+         ivec2 glyphPos = ivec2 (j, k);
+         imageStore (imgOut, charPos * glyphPixels + glyphPos,
+                     shadePixel (s, glyphPos));
       }
    }
+}
+)";
+
+   // One invocation per pixel, in workgroups covering tiles of cells
+   // (with the tile size supplied as a #define)
+   static const char *computeShaderTiledMain = R"(
+layout (local_size_x = TILE_PX_X, local_size_y = TILE_PX_Y) in;
+
+void main ()
+{
+   ivec2 pxPos = originChars * glyphPixels + ivec2 (gl_GlobalInvocationID.xy);
+   ivec2 charPos = pxPos / glyphPixels;
+   if (charPos.x >= sizeChars.x || charPos.y >= sizeChars.y)
+      return;
+   ivec2 glyphPos = pxPos - charPos * glyphPixels; // pixel within the glyph
+   int idx = sizeChars.x * charPos.y + charPos.x;
+   Cell cell = vmem.cells[idx];
 
-   if (charPos == cursorPos.xy && cursorStyle == 2)
+   uint dwidth_cont = bitfieldExtract (cell.charData, 17, 1);
+   if (dwidth_cont == 1u) // double-width cell continuation - drawn by left half
    {
-      vec4 pixel = vec4 (crColor, 1.0);
-      for (int j = 0; j < srcGlyphPixels.x; j++)
-      {
-         ivec2 pxCoords = charPos * glyphPixels + ivec2 (j, 0);
-         imageStore (imgOut, pxCoords, pixel);
-         pxCoords += ivec2 (0, srcGlyphPixels.y - 1);
-         imageStore (imgOut, pxCoords, pixel);
-      }
-      for (int k = 1; k < srcGlyphPixels.y - 1; k++)
-      {
-         ivec2 pxCoords = charPos * glyphPixels + ivec2 (0, k);
-         imageStore (imgOut, pxCoords, pixel);
-         pxCoords += ivec2 (srcGlyphPixels.x - 1, 0);
-         imageStore (imgOut, pxCoords, pixel);
-      }
+      if (charPos.x == 0 ||
+          bitfieldExtract (vmem.cells[idx - 1].charData, 16, 1) != 1u)
+         return;
+
+      charPos.x -= 1;
+      idx -= 1;
+      glyphPos.x += glyphPixels.x;
+      cell = vmem.cells[idx];
    }
+
+   if (!isDamaged (idx, charPos))
+      return;
+
+   Shading s = shadeCell (cell, idx, charPos);
+   if (s.dwidth == 0u && glyphPos.x >= glyphPixels.x)
+      return; // right half of a cell that turned out not to be double-width
+
+   imageStore (imgOut, charPos * glyphPixels + glyphPos,
+               shadePixel (s, glyphPos));
 }
 )";
 
@@ -297,6 +358,152 @@ void main ()
       }
    }
 
+   struct ShaderSource
+   {
+      GLuint type;
+      const char* src;
+      const char* name;
+   };
+
+   // Layout of a program cache file: the header is followed by the key
+   // and the program binary.
+   constexpr const char programCacheMagic [8] =
+      {'Z','P','R','O','G','0','0','1'};
+
+   struct ProgramCacheHeader
+   {
+      char magic [8];
+      uint32_t keySize;
+      uint32_t binaryFormat;
+      uint32_t binarySize;
+   };
+
+   // A linked program from the binary in the cache file at path, if it
+   // has been saved from the same shaders by the same driver, and the
+   // driver still accepts it; else 0.
+   GLuint
+   loadCachedProgram (const std::string& path, const std::string& key)
+   {
+      std::ifstream ifs (path, std::ios::binary | std::ios::ate);
+      const std::streamoff fileSize = ifs.tellg ();
+      ifs.seekg (0);
+      ProgramCacheHeader hdr;
+      if (!ifs.read ((char*) &hdr, sizeof (hdr)) ||
+          memcmp (hdr.magic, programCacheMagic, sizeof (hdr.magic)) ||
+          hdr.keySize != key.size ())
+         return 0;
+
+      // Do not trust the sizes before allocating: the file might be
+      // truncated or corrupt.
+      if (fileSize < 0 || (uint64_t) fileSize !=
+          sizeof (hdr) + (uint64_t) hdr.keySize + hdr.binarySize)
+         return 0;
+
+      std::string fileKey (hdr.keySize, '\0');
+      std::vector <char> binary (hdr.binarySize);
+      if (!ifs.read (&fileKey [0], fileKey.size ()) || fileKey != key ||
+          !ifs.read (binary.data (), binary.size ()))
+         return 0;
+
+      GLuint program = glCreateProgram ();
+      glProgramBinary (program, hdr.binaryFormat, binary.data (),
+                       binary.size ());
+      GLint stat = GL_FALSE;
+      glGetProgramiv (program, GL_LINK_STATUS, &stat);
+      if (!stat)
+      {
+         // e.g., the driver got updated without changing its version
+         glDeleteProgram (program);
+         glGetError (); // discard any error raised by glProgramBinary ()
+         return 0;
+      }
+      return program;
+   }
+
+   void
+   saveCachedProgram (const std::string& path, const std::string& key,
+                      GLuint program)
+   {
+      GLint size = 0;
+      glGetProgramiv (program, GL_PROGRAM_BINARY_LENGTH, &size);
+      if (size <= 0)
+         return;
+
+      std::vector <char> binary (size);
+      GLenum format = 0;
+      glGetProgramBinary (program, size, &size, &format, binary.data ());
+      if (glGetError () != GL_NO_ERROR)
+         return;
+
+      ProgramCacheHeader hdr;
+      memset (&hdr, 0, sizeof (hdr));
+      memcpy (hdr.magic, programCacheMagic, sizeof (hdr.magic));
+      hdr.keySize = key.size ();
+      hdr.binaryFormat = format;
+      hdr.binarySize = size;
+
+      std::string data ((const char*) &hdr, sizeof (hdr));
+      data.append (key);
+      data.append (binary.data (), size);
+      if (zutty::writeCacheFile (path, data.data (), data.size ()))
+         logT << "Saved program to cache " << path << std::endl;
+   }
+
+   /* The program linked from the given shaders. If the driver supports
+    * program binaries, the linked program is saved to the cache, keyed
+    * by the driver (renderer and version) and the shader sources, and
+    * loaded from there next time; it is only built from source if there
+    * is no cached binary, or the one found is rejected by the driver.
+    */
+   GLuint
+   makeProgram (const char* name, const std::vector <ShaderSource>& shaders)
+   {
+      GLint nFormats = 0;
+      glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+      const std::string cacheDir = nFormats > 0 ? zutty::getCacheDir () : "";
+
+      std::string key, path;
+      if (!cacheDir.empty ())
+      {
+         std::ostringstream oss;
+         oss << glGetString (GL_RENDERER) << '|' << glGetString (GL_VERSION);
+         for (const auto& sh: shaders)
+            oss << '|' << std::hash <std::string> () (sh.src);
+         key = oss.str ();
+
+         oss.str ("");
+         oss << cacheDir << "/program-" << name << '-' << std::hex
+             << std::hash <std::string> () (key);
+         path = oss.str ();
+
+         GLuint program = loadCachedProgram (path, key);
+         if (program)
+         {
+            logT << "Loaded " << name << " program from cache " << path
+                 << std::endl;
+            return program;
+         }
+      }
+
+      std::vector <GLuint> compiled;
+      for (const auto& sh: shaders)
+         compiled.push_back (createShader (sh.type, sh.src, sh.name));
+
+      GLuint program = glCreateProgram ();
+      for (GLuint shader: compiled)
+         glAttachShader (program, shader);
+      if (!path.empty ())
+         glProgramParameteri (program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                              GL_TRUE);
+      linkProgram (program, name);
+      for (GLuint shader: compiled)
+         glDeleteShader (shader); // N.B.: freed along with the program
+
+      if (!path.empty ())
+         saveCachedProgram (path, key, program);
+      return program;
+   }
+
    void
    setupTexture (GLuint target, GLenum type, GLuint& texture)
    {
@@ -314,6 +521,34 @@ void main ()
       glTexParameteri (type, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
    }
 
+   // Font to use for an atlas layer (see the font index in the shader)
+   const zutty::Font&
+   getLayerFont (const zutty::Fontpack& fontpk, int layer)
+   {
+      switch (layer)
+      {
+      case 1:
+         if (fontpk.hasBold ())
+            return fontpk.getBold ();
+         break;
+      case 2:
+         if (fontpk.hasItalic ())
+            return fontpk.getItalic ();
+         break;
+      case 3:
+         if (fontpk.hasBoldItalic ())
+            return fontpk.getBoldItalic ();
+         else if (fontpk.hasItalic ())
+            return fontpk.getItalic ();
+         else if (fontpk.hasBold ())
+            return fontpk.getBold ();
+         break;
+      default:
+         break;
+      }
+      return fontpk.getRegular ();
+   }
+
    void
    setupAtlasTexture (const zutty::Font& fnt, int idx)
    {
@@ -374,20 +609,6 @@ void main ()
                    GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, atlasMap.data ());
    }
 
-   template <typename T> void
-   setupStorageBuffer (GLuint index, GLuint& buffer, uint32_t n_items)
-   {
-      if (buffer)
-      {
-         glDeleteBuffers (1, &buffer);
-      }
-      glGenBuffers (1, &buffer);
-      glBindBuffer (GL_SHADER_STORAGE_BUFFER, buffer);
-      glBindBufferBase (GL_SHADER_STORAGE_BUFFER, index, buffer);
-      std::size_t size = sizeof (T) * n_items;
-      glBufferData (GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
-   }
-
 } // namespace
 
 namespace zutty
@@ -444,28 +665,11 @@ namespace zutty
                       4); // number of layers
       glCheckError ();
 
-      setupAtlasTexture (reg, 0);
-
-      if (fontpk->hasBold ())
-         setupAtlasTexture (fontpk->getBold (), 1);
-      else
-         setupAtlasTexture (fontpk->getRegular (), 1);
-
-      if (fontpk->hasItalic ())
-         setupAtlasTexture (fontpk->getItalic (), 2);
-      else
-         setupAtlasTexture (fontpk->getRegular (), 2);
-
-      if (fontpk->hasBoldItalic ())
-         setupAtlasTexture (fontpk->getBoldItalic (), 3);
-      else if (fontpk->hasItalic ())
-         setupAtlasTexture (fontpk->getItalic (), 3);
-      else if (fontpk->hasBold ())
-         setupAtlasTexture (fontpk->getBold (), 3);
-      else
-         setupAtlasTexture (fontpk->getRegular (), 3);
+      for (int layer = 0; layer < 4; ++layer)
+         setupAtlasTexture (getLayerFont (*fontpk, layer), layer);
 
       setupAtlasMappingTexture (reg, GL_TEXTURE2, T_atlasMap);
+      initGlyphCache (glyphs, reg, false);
 
       // Setup atlas texture for double-width characters
       if (fontpk->hasDoubleWidth ())
@@ -482,22 +686,54 @@ namespace zutty
 
          setupAtlasTexture (dw, 0);
          setupAtlasMappingTexture (dw, GL_TEXTURE3, T_atlasMap_dw);
+         initGlyphCache (glyphs_dw, dw, true);
       }
       glUniform1i (compU_hasDoubleWidth, hasDoubleWidth ? 1 : 0);
 
+      const char* ext = (const char*) glGetString (GL_EXTENSIONS);
+      if (ext && strstr (ext, "GL_EXT_buffer_storage"))
+         bufferStorage = (PFNGLBUFFERSTORAGEEXTPROC)
+            eglGetProcAddress ("glBufferStorageEXT");
+      logT << "Persistent mapping of cell storage: "
+           << (bufferStorage ? "enabled" : "not supported") << std::endl;
+
+      // The color table is sized for all codes, with entries uploaded as
+      // they come into use
+      glGenBuffers (1, &B_colors);
+      glBindBuffer (GL_SHADER_STORAGE_BUFFER, B_colors);
+      glBufferData (GL_SHADER_STORAGE_BUFFER,
+                    Color_Code_Count * sizeof (uint32_t), nullptr,
+                    GL_DYNAMIC_DRAW);
+      glCheckError ();
+
+      if ((opts.hud || opts.statsFile) && ext &&
+          strstr (ext, "GL_EXT_disjoint_timer_query"))
+         glGenQueries (2, Q_timers);
+      logT << "GPU timer queries: "
+           << (Q_timers [0] ? "enabled" : "not used") << std::endl;
+
       // Now that it's all loaded into GL, no need to keep font data in-memory
-      fontpk->releaseFonts ();
+      // (unless more glyphs are to be loaded later)
+      if (glyphs.lazy || glyphs_dw.lazy)
+         lazyFonts = fontpk;
+      else
+         fontpk->releaseFonts ();
    }
 
    CharVdev::~CharVdev ()
    {
+      for (auto& reg: regions)
+         if (reg.fence)
+            glDeleteSync (reg.fence);
+      if (Q_timers [0])
+         glDeleteQueries (2, Q_timers);
+      if (B_colors)
+         glDeleteBuffers (1, &B_colors);
    }
 
    bool
    CharVdev::resize (uint16_t pxWidth_, uint16_t pxHeight_)
    {
-      assert (cells == nullptr); // no mapping in place
-
       if (pxWidth == pxWidth_ && pxHeight == pxHeight_)
          return false;
 
@@ -529,7 +765,7 @@ namespace zutty
                           GL_RGBA32F);
       glCheckError ();
 
-      setupStorageBuffer <Cell> (0, B_text, nRows * nCols);
+      setupCellStorage ();
 
       return true;
    }
@@ -544,6 +780,8 @@ namespace zutty
       glUniform3i (compU_cursorColor,
                    cursor.color.red, cursor.color.green, cursor.color.blue);
       glUniform4i (compU_cursorPos, cursor.posX, cursor.posY, prevPosX, prevPosY);
+      addDrawSpan (cursor.posY, cursor.posX, cursor.posX + 1);
+      addDrawSpan (prevPosY, prevPosX, prevPosX + 1);
       prevPosX = cursor.posX;
       prevPosY = cursor.posY;
       glUniform1i (compU_cursorStyle, static_cast <uint8_t> (cursor.style));
@@ -556,6 +794,12 @@ namespace zutty
       Rect damage (std::min (sel.tl, prev.tl), std::max (sel.br, prev.br));
       uint32_t damageStart = nCols * damage.tl.y + damage.tl.x;
       uint32_t damageEnd = nCols * damage.br.y + damage.br.x + 1;
+      if (!(sel.tl == prev.tl && sel.br == prev.br &&
+            sel.rectangular == prev.rectangular))
+      {
+         for (int pY = damage.tl.y; pY <= damage.br.y; ++pY)
+            addDrawSpan (pY, 0, nCols);
+      }
       prev = sel;
 
       glUseProgram (P_compute);
@@ -567,14 +811,155 @@ namespace zutty
    void
    CharVdev::setDeltaFrame (bool delta)
    {
+      deltaFrame = delta;
       glUseProgram (P_compute);
       glUniform1i (compU_deltaFrame, delta ? 1 : 0);
    }
 
    void
+   CharVdev::setOverlay (const std::string& text)
+   {
+      overlay = text;
+   }
+
+   bool
+   CharVdev::waitForRegion ()
+   {
+      Region& reg = regions [curRegion];
+      if (!reg.fence)
+         return true;
+
+      const GLenum rc = glClientWaitSync (reg.fence,
+                                          GL_SYNC_FLUSH_COMMANDS_BIT,
+                                          fenceTimeout);
+      glDeleteSync (reg.fence);
+      reg.fence = nullptr;
+      switch (rc)
+      {
+      case GL_ALREADY_SIGNALED:
+      case GL_CONDITION_SATISFIED:
+         return true;
+      case GL_TIMEOUT_EXPIRED:
+         logW << "GPU still using cell storage after "
+              << fenceTimeout / 1000000 << " ms" << std::endl;
+         return false;
+      default:
+         logW << "Waiting for cell storage fence failed (GL error 0x"
+              << std::hex << glGetError () << std::dec << ")" << std::endl;
+         return false;
+      }
+   }
+
+   bool
+   CharVdev::setCells (uint16_t nCols_, uint16_t nRows_,
+                       const Cell* cells, const RowSpan* damage, bool delta)
+   {
+      assert (nCols_ == nCols);
+      assert (nRows_ == nRows);
+
+      curRegion = (curRegion + 1) % nRegions;
+      if (!waitForRegion ())
+      {
+         // Do not overwrite a region the GPU might still read from
+         logW << "Falling back to buffer updates for cell storage"
+              << std::endl;
+         bufferStorage = nullptr;
+         setupCellStorage ();
+         delta = false;
+      }
+      Region& reg = regions [curRegion];
+
+      std::fill (dirtyMask.begin (), dirtyMask.end (), 0);
+      std::fill (drawSpans.begin (), drawSpans.end (), RowSpan ());
+      if (delta)
+      {
+         for (uint16_t pY = 0; pY < nRows; ++pY)
+         {
+            int changedX1 = nCols;
+            int changedX2 = 0;
+            const size_t rowStart = pY * nCols;
+            for (int x = damage [pY].start; x < damage [pY].end; ++x)
+            {
+               const size_t k = rowStart + x;
+               if (shadow [k] != cells [k])
+               {
+                  trackGlyph (shadow [k], false);
+                  shadow [k] = cells [k];
+                  trackGlyph (shadow [k], true);
+                  dirtyMask [k >> 5] |= 1u << (k & 31);
+                  changedX1 = std::min (changedX1, x);
+                  changedX2 = x + 1;
+               }
+            }
+            if (changedX1 < changedX2)
+            {
+               addDrawSpan (pY, changedX1, changedX2);
+               for (int r = 0; r < nRegions; ++r)
+                  regions [r].staleRows [pY] = 1;
+            }
+         }
+      }
+      else
+      {
+         std::copy (cells, cells + shadow.size (), shadow.begin ());
+         for (GlyphCache* gc: {&glyphs, &glyphs_dw})
+            resetGlyphUse (*gc);
+         for (const Cell& cell: shadow)
+            trackGlyph (cell, true);
+         for (int r = 0; r < nRegions; ++r)
+            std::fill (regions [r].staleRows.begin (),
+                       regions [r].staleRows.end (), 1);
+      }
+      applyOverlay (cells);
+
+      uploadColors ();
+
+      // Bring the region up to date, in runs of adjacent stale rows
+      const size_t offset = curRegion * regionBytes;
+      const size_t rowBytes = nCols * sizeof (Cell);
+      for (uint16_t pY = 0; pY < nRows; )
+      {
+         if (!reg.staleRows [pY])
+         {
+            ++pY;
+            continue;
+         }
+
+         uint16_t end = pY;
+         while (end < nRows && reg.staleRows [end])
+            reg.staleRows [end++] = 0;
+         upload (offset + pY * rowBytes, shadow.data () + pY * nCols,
+                 (end - pY) * rowBytes);
+         pY = end;
+      }
+
+      const size_t maskBytes = dirtyMask.size () * sizeof (uint32_t);
+      upload (offset + cellsBytes, dirtyMask.data (), maskBytes);
+
+      glBindBufferRange (GL_SHADER_STORAGE_BUFFER, 0, B_text,
+                         offset, shadow.size () * sizeof (Cell));
+      glBindBufferRange (GL_SHADER_STORAGE_BUFFER, 1, B_text,
+                         offset + cellsBytes, maskBytes);
+      glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 2, B_colors);
+      glCheckError ();
+      return delta;
+   }
+
+   bool
    CharVdev::draw ()
    {
-      assert (cells == nullptr); // no mapping in place
+      swapDamage.clear ();
+      if (deltaFrame && std::all_of (drawSpans.begin (), drawSpans.end (),
+                                     [] (const RowSpan& span)
+                                     {
+                                        return span.start == span.end;
+                                     }))
+         return false;
+
+      // Time this frame on the GPU, unless still waiting for the results
+      // of an earlier one
+      collectGpuTimes ();
+      const bool timed = Q_timers [0] && !timersPending;
 
       glUseProgram (P_compute);
       glActiveTexture (GL_TEXTURE0);
@@ -592,8 +977,41 @@ namespace zutty
       }
       glCheckError ();
 
-      glDispatchCompute (nCols, nRows, 1);
+      if (timed)
+         glBeginQuery (GL_TIME_ELAPSED_EXT, Q_timers [0]);
+      if (deltaFrame)
+      {
+         // Dispatch the bands of adjacent rows with anything to redraw
+         for (uint16_t pY = 0; pY < nRows; )
+         {
+            if (drawSpans [pY].start == drawSpans [pY].end)
+            {
+               ++pY;
+               continue;
+            }
+
+            const uint16_t y1 = pY;
+            uint16_t x1 = nCols;
+            uint16_t x2 = 0;
+            for (; pY < nRows && drawSpans [pY].start != drawSpans [pY].end;
+                 ++pY)
+            {
+               x1 = std::min (x1, drawSpans [pY].start);
+               x2 = std::max (x2, drawSpans [pY].end);
+            }
+            dispatch (x1, y1, x2, pY);
+         }
+      }
+      else
+      {
+         dispatch (0, 0, nCols, nRows);
+      }
       glMemoryBarrier (GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+      if (timed)
+         glEndQuery (GL_TIME_ELAPSED_EXT);
+      if (mapped)
+         regions [curRegion].fence =
+            glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
       glCheckError ();
 
       glUseProgram (P_draw);
@@ -606,53 +1024,464 @@ namespace zutty
 
       glEnableVertexAttribArray (A_pos);
       glEnableVertexAttribArray (A_vertexTexCoord);
+      if (timed)
+         glBeginQuery (GL_TIME_ELAPSED_EXT, Q_timers [1]);
       glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+      if (timed)
+      {
+         glEndQuery (GL_TIME_ELAPSED_EXT);
+         timersPending = true;
+      }
+      return true;
    }
 
-   CharVdev::Mapping::Mapping (uint16_t nCols_, uint16_t nRows_, Cell *& cells_)
-      : nCols (nCols_)
-      , nRows (nRows_)
-      , cells (cells_)
+   // private methods
+
+   void
+   CharVdev::setupCellStorage ()
    {
-   };
+      for (auto& reg: regions)
+         if (reg.fence)
+         {
+            glDeleteSync (reg.fence);
+            reg.fence = nullptr;
+         }
+      if (B_text)
+         glDeleteBuffers (1, &B_text); // N.B.: also unmaps it
+      mapped = nullptr;
+
+      GLint align = 1;
+      glGetIntegerv (GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+      auto alignUp = [align] (size_t n)
+                     {
+                        return (n + align - 1) / align * align;
+                     };
+
+      const size_t nCells = nRows * nCols;
+      shadow.assign (nCells, Cell ());
+      overlayX = nCols;
+      dirtyMask.assign ((nCells + 31) / 32, 0);
+      drawSpans.assign (nRows, RowSpan ());
+      cellsBytes = alignUp (nCells * sizeof (Cell));
+      regionBytes = alignUp (cellsBytes +
+                             dirtyMask.size () * sizeof (uint32_t));
+
+      nRegions = bufferStorage ? maxRegions : 1;
+      curRegion = 0;
+      for (int r = 0; r < nRegions; ++r)
+         regions [r].staleRows.assign (nRows, 1);
+
+      glGenBuffers (1, &B_text);
+      glBindBuffer (GL_SHADER_STORAGE_BUFFER, B_text);
+      const size_t size = regionBytes * nRegions;
+      if (bufferStorage)
+      {
+         const GLbitfield flags = GL_MAP_WRITE_BIT |
+            GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+         bufferStorage (GL_SHADER_STORAGE_BUFFER, size, nullptr, flags);
+         mapped = reinterpret_cast <uint8_t *> (
+            glMapBufferRange (GL_SHADER_STORAGE_BUFFER, 0, size, flags));
+         if (!mapped)
+         {
+            logW << "Persistent mapping of cell storage failed, "
+                 << "falling back to buffer updates" << std::endl;
+            bufferStorage = nullptr;
+            setupCellStorage ();
+            return;
+         }
+      }
+      else
+      {
+         glBufferData (GL_SHADER_STORAGE_BUFFER, size, nullptr,
+                       GL_DYNAMIC_DRAW);
+      }
+      glCheckError ();
+   }
 
-   CharVdev::Mapping::~Mapping ()
+   void
+   CharVdev::addDrawSpan (int pY, int startX, int endX)
    {
-      assert (cells != nullptr); // mapping in place
+      // N.B.: the cursor might be off-screen (in the scrollback history)
+      if (pY < 0 || pY >= nRows)
+         return;
 
-      glUnmapBuffer (GL_SHADER_STORAGE_BUFFER);
-      cells = nullptr;
-   };
+      startX = std::max (0, startX);
+      endX = std::min ((int) nCols, endX);
+      if (startX >= endX)
+         return;
+
+      RowSpan& span = drawSpans [pY];
+      if (span.start == span.end)
+      {
+         span.start = startX;
+         span.end = endX;
+      }
+      else
+      {
+         span.start = std::min ((int) span.start, startX);
+         span.end = std::max ((int) span.end, endX);
+      }
+   }
 
-   CharVdev::Mapping CharVdev::getMapping ()
+   void
+   CharVdev::applyOverlay (const Cell* cells)
+   {
+      // Columns covered by the overlay now, or the last time (to be
+      // given back to the cells beneath it)
+      const int len = std::min (overlay.size (), (size_t) nCols);
+      const int x0 = nCols - len;
+      for (int x = std::min (x0, (int) overlayX); x < nCols; ++x)
+      {
+         Cell cell = cells [x];
+         if (x >= x0)
+         {
+            cell = Cell ();
+            cell.uc_pt = (unsigned char) overlay [x - x0];
+            cell.inverse = 1;
+         }
+         if (shadow [x] == cell)
+            continue;
+
+         trackGlyph (shadow [x], false);
+         shadow [x] = cell;
+         trackGlyph (shadow [x], true);
+         dirtyMask [x >> 5] |= 1u << (x & 31);
+         addDrawSpan (0, x, x + 1);
+         for (int r = 0; r < nRegions; ++r)
+            regions [r].staleRows [0] = 1;
+      }
+      overlayX = x0;
+   }
+
+   void
+   CharVdev::collectGpuTimes ()
    {
-      assert (cells == nullptr); // no mapping in place
+      if (!timersPending)
+         return;
 
-      cells = reinterpret_cast <Cell *> (
-                 glMapBufferRange (GL_SHADER_STORAGE_BUFFER,
-                                   0, sizeof (Cell) * nRows * nCols,
-                                   GL_MAP_READ_BIT | GL_MAP_WRITE_BIT));
+      // N.B.: the compute pass was queried first, so it is done by now
+      // if the draw pass is
+      GLuint available = 0;
+      glGetQueryObjectuiv (Q_timers [1], GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+      if (!available)
+         return;
+      timersPending = false;
 
-      return CharVdev::Mapping (nCols, nRows, cells);
-   };
+      // Results are meaningless if the GPU got disturbed meanwhile
+      GLint disjoint = 0;
+      glGetIntegerv (GL_GPU_DISJOINT_EXT, &disjoint);
+      if (disjoint)
+         return;
 
-   // private methods
+      GLuint computeNs = 0, drawNs = 0;
+      glGetQueryObjectuiv (Q_timers [0], GL_QUERY_RESULT, &computeNs);
+      glGetQueryObjectuiv (Q_timers [1], GL_QUERY_RESULT, &drawNs);
+      stats::add (stats::ComputeGpuNs, computeNs);
+      stats::add (stats::DrawGpuNs, drawNs);
+      stats::add (stats::GpuTimed, 1);
+   }
 
    void
-   CharVdev::createShaders ()
+   CharVdev::dispatch (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+   {
+      glUniform2i (compU_originChars, x1, y1);
+      if (tileCols)
+      {
+         // N.B.: the right half of a double-width cell is drawn by the
+         // invocations of the cell to its right
+         const int w = std::min (x2 + 1, (int) nCols) - x1;
+         const int h = y2 - y1;
+         glDispatchCompute ((w + tileCols - 1) / tileCols,
+                            (h + tileRows - 1) / tileRows, 1);
+      }
+      else
+      {
+         glDispatchCompute (x2 - x1, y2 - y1, 1);
+      }
+
+      if (deltaFrame)
+      {
+         // Window coordinates have their origin at the bottom left; a
+         // double-width glyph extends into the column to its right.
+         const int x2p = std::min (x2 + 1, (int) nCols);
+         swapDamage.insert (swapDamage.end (),
+                            {opts.border + x1 * px,
+                             pxHeight - opts.border - y2 * py,
+                             (x2p - x1) * px,
+                             (y2 - y1) * py});
+      }
+   }
+
+   void
+   CharVdev::upload (size_t offset, const void* data, size_t size)
+   {
+      if (mapped)
+         memcpy (mapped + offset, data, size);
+      else
+         glBufferSubData (GL_SHADER_STORAGE_BUFFER, offset, size, data);
+   }
+
+   void
+   CharVdev::uploadColors ()
+   {
+      // N.B.: all codes referred to by the cells being drawn are counted,
+      // as the snapshot of the cells was taken after they were interned.
+      // Codes are only reused once the table is full; any reuse since the
+      // last upload changes some entry, so the whole table is uploaded.
+      const uint32_t reused = getColorReuseCount ();
+      if (reused != colorsReused)
+      {
+         colorsUploaded = 0;
+         colorsReused = reused;
+      }
+      const uint32_t n = getColorCount ();
+      if (n == colorsUploaded)
+         return;
+
+      std::vector <uint32_t> entries (n - colorsUploaded);
+      for (uint32_t c = colorsUploaded; c < n; ++c)
+         entries [c - colorsUploaded] = getColorEntry (c);
+      glBindBuffer (GL_SHADER_STORAGE_BUFFER, B_colors);
+      glBufferSubData (GL_SHADER_STORAGE_BUFFER,
+                       colorsUploaded * sizeof (uint32_t),
+                       entries.size () * sizeof (uint32_t), entries.data ());
+      glBindBuffer (GL_SHADER_STORAGE_BUFFER, B_text); // see upload ()
+      glCheckError ();
+      colorsUploaded = n;
+   }
+
+   void
+   CharVdev::initGlyphCache (GlyphCache& gc, const Font& fnt, bool dwidth)
+   {
+      gc.lazy = fnt.isLazy ();
+      gc.dwidth = dwidth;
+      if (!gc.lazy)
+         return;
+
+      const size_t nSlots = fnt.getNx () * fnt.getNy ();
+      gc.slotChar.assign (nSlots, -1);
+      gc.slotPinned.assign (nSlots, 0);
+      gc.slotPinned [0] = 1; // the blank glyph
+      gc.charSlot.assign (std::numeric_limits <uint16_t>::max () + 1, 0);
+      gc.useCount.assign (gc.charSlot.size (), 0);
+
+      // Glyphs loaded up front stay in place
+      for (const auto& it: fnt.getAtlasMap ())
+      {
+         const int slot = it.second.y * fnt.getNx () + it.second.x;
+         gc.slotChar [slot] = it.first;
+         gc.slotPinned [slot] = 1;
+         gc.charSlot [it.first] = slot;
+      }
+
+      gc.slotPrev.assign (nSlots + 1, -1);
+      gc.slotNext.assign (nSlots + 1, -1);
+      gc.slotPrev [nSlots] = gc.slotNext [nSlots] = nSlots;
+      for (size_t slot = 0; slot < nSlots; ++slot)
+         if (!gc.slotPinned [slot])
+            linkSlot (gc, slot);
+
+      const auto mg = fnt.getAtlasMap ().find (Missing_Glyph_Marker);
+      if (mg != fnt.getAtlasMap ().end ())
+         gc.missing = mg->second;
+
+      logT << "Atlas of " << nSlots << " glyphs, " << fnt.getAtlasMap ().size ()
+           << " loaded up front" << (dwidth ? " (double-width)" : "")
+           << std::endl;
+   }
+
+   // Put slot last in the ring of slots that may be taken. Free slots
+   // are only ever put there up front, so they are taken first.
+   void
+   CharVdev::linkSlot (GlyphCache& gc, int slot)
+   {
+      if (gc.slotPrev [slot] >= 0)
+         return;
+      const int ring = gc.slotChar.size ();
+      const int prev = gc.slotPrev [ring];
+      gc.slotPrev [slot] = prev;
+      gc.slotNext [slot] = ring;
+      gc.slotNext [prev] = slot;
+      gc.slotPrev [ring] = slot;
+   }
+
+   void
+   CharVdev::unlinkSlot (GlyphCache& gc, int slot)
+   {
+      if (gc.slotPrev [slot] < 0)
+         return;
+      gc.slotNext [gc.slotPrev [slot]] = gc.slotNext [slot];
+      gc.slotPrev [gc.slotNext [slot]] = gc.slotPrev [slot];
+      gc.slotPrev [slot] = gc.slotNext [slot] = -1;
+   }
+
+   // Forget all glyphs being in use (before tracking a full frame anew).
+   // Those that were become the last to evict, as the most recent ones.
+   void
+   CharVdev::resetGlyphUse (GlyphCache& gc)
+   {
+      if (!gc.lazy)
+         return;
+
+      std::fill (gc.useCount.begin (), gc.useCount.end (), 0);
+      for (size_t slot = 0; slot < gc.slotChar.size (); ++slot)
+         if (!gc.slotPinned [slot])
+            linkSlot (gc, slot);
+   }
+
+   // Account for a cell change; shown is false if the cell was overwritten
+   void
+   CharVdev::trackGlyph (const Cell& cell, bool shown)
+   {
+      GlyphCache& gc = cell.dwidth ? glyphs_dw : glyphs;
+      if (!gc.lazy)
+         return;
+
+      const uint16_t c = cell.uc_pt;
+      if (shown)
+      {
+         if (gc.useCount [c]++ == 0)
+         {
+            if (gc.charSlot [c])
+               unlinkSlot (gc, gc.charSlot [c]);
+            else
+               loadGlyph (gc, c);
+         }
+      }
+      else if (gc.useCount [c] && --gc.useCount [c] == 0 && gc.charSlot [c] &&
+               !gc.slotPinned [gc.charSlot [c]])
+      {
+         linkSlot (gc, gc.charSlot [c]);
+      }
+   }
+
+   void
+   CharVdev::loadGlyph (GlyphCache& gc, uint16_t c)
+   {
+      const Font& pri = gc.dwidth ? lazyFonts->getDoubleWidth ()
+                                  : lazyFonts->getRegular ();
+      if (!pri.hasGlyph (c))
+         return;
+
+      // Take a free slot, or the least recently used glyph's
+      const int slot = gc.slotNext [gc.slotChar.size ()];
+      if (slot == (int) gc.slotChar.size ())
+      {
+         logT << "Glyph atlas full, cannot load code point " << c
+              << std::endl;
+         return;
+      }
+      unlinkSlot (gc, slot);
+
+      const Font::AtlasPos apos = {(uint8_t) (slot % pri.getNx ()),
+                                   (uint8_t) (slot / pri.getNx ())};
+      if (gc.slotChar [slot] >= 0)
+      {
+         const uint16_t old = gc.slotChar [slot];
+         gc.charSlot [old] = 0;
+         lazyFonts->unloadGlyph (old, gc.dwidth);
+         setAtlasMapEntry (gc, old, gc.missing);
+      }
+      gc.slotChar [slot] = c;
+      gc.charSlot [c] = slot;
+      lazyFonts->loadGlyph (c, apos, gc.dwidth);
+
+      glActiveTexture (gc.dwidth ? GL_TEXTURE3 : GL_TEXTURE1);
+      glBindTexture (GL_TEXTURE_2D_ARRAY, gc.dwidth ? T_atlas_dw : T_atlas);
+      glPixelStorei (GL_UNPACK_ROW_LENGTH, pri.getNx () * pri.getPx ());
+      for (int layer = 0; layer < (gc.dwidth ? 1 : 4); ++layer)
+      {
+         const Font& fnt = gc.dwidth ? pri : getLayerFont (*lazyFonts, layer);
+         glTexSubImage3D (GL_TEXTURE_2D_ARRAY, 0,
+                          apos.x * pri.getPx (), apos.y * pri.getPy (), layer,
+                          pri.getPx (), pri.getPy (), 1,
+                          GL_RGBA, GL_UNSIGNED_BYTE, fnt.getGlyphData (apos));
+      }
+      glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+      setAtlasMapEntry (gc, c, apos);
+      glCheckError ();
+   }
+
+   void
+   CharVdev::setAtlasMapEntry (const GlyphCache& gc, uint16_t c,
+                               const Font::AtlasPos& apos)
    {
-      GLuint S_compute, S_fragment, S_vertex;
+      const uint8_t texel [2] = {apos.x, apos.y};
+      glActiveTexture (gc.dwidth ? GL_TEXTURE4 : GL_TEXTURE2);
+      glBindTexture (GL_TEXTURE_2D, gc.dwidth ? T_atlasMap_dw : T_atlasMap);
+      glTexSubImage2D (GL_TEXTURE_2D, 0, c & 0xff, c >> 8, 1, 1,
+                       GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, texel);
+   }
 
-      S_compute =
-         createShader (GL_COMPUTE_SHADER, computeShaderSource, "compute");
-      S_fragment =
-         createShader (GL_FRAGMENT_SHADER, fragmentShaderSource, "fragment");
-      S_vertex =
-         createShader (GL_VERTEX_SHADER, vertexShaderSource, "vertex");
+   bool
+   CharVdev::chooseTiles ()
+   {
+      tileCols = tileRows = 0;
+      if (!opts.gpuTiles)
+         return false;
+
+      GLint maxInvocations, maxX, maxY;
+      glGetIntegerv (GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+      glGetIntegeri_v (GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxX);
+      glGetIntegeri_v (GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &maxY);
+
+      auto fits = [&] (int cols, int rows)
+                  {
+                     return cols * px <= maxX && rows * py <= maxY &&
+                            cols * px * rows * py <= maxInvocations;
+                  };
 
-      P_compute = glCreateProgram ();
-      glAttachShader (P_compute, S_compute);
-      linkProgram (P_compute, "compute");
+      if (!fits (1, 1))
+      {
+         logW << "Glyphs of " << px << "x" << py << " pixels are too large "
+              << "for a compute workgroup; not using tiles" << std::endl;
+         return false;
+      }
+
+      // Grow the tile, alternating between width and height, while the
+      // workgroup still fits the limits of the GPU
+      tileCols = tileRows = 1;
+      bool grown = true;
+      while (grown)
+      {
+         grown = false;
+         if (fits (tileCols + 1, tileRows))
+         {
+            ++tileCols;
+            grown = true;
+         }
+         if (fits (tileCols, tileRows + 1))
+         {
+            ++tileRows;
+            grown = true;
+         }
+      }
+
+      logT << "Compute shader: tiles of " << tileCols << "x" << tileRows
+           << " cells (max. invocations: " << maxInvocations << ")"
+           << std::endl;
+      return true;
+   }
+
+   void
+   CharVdev::createShaders ()
+   {
+      std::string computeSrc;
+      if (chooseTiles ())
+      {
+         computeSrc = std::string ("#version 310 es\n") +
+            "#define TILE_PX_X " + std::to_string (tileCols * px) + "\n" +
+            "#define TILE_PX_Y " + std::to_string (tileRows * py) + "\n" +
+            computeShaderCommon + computeShaderTiledMain;
+      }
+      else
+      {
+         computeSrc = std::string (computeShaderCell) +
+            computeShaderCommon + computeShaderCellMain;
+      }
+      P_compute = makeProgram (
+         "compute", {{GL_COMPUTE_SHADER, computeSrc.c_str (), "compute"}});
       glUseProgram (P_compute);
 
       compU_glyphPixels = glGetUniformLocation (P_compute, "glyphPixels");
@@ -666,6 +1495,7 @@ namespace zutty
       compU_deltaFrame = glGetUniformLocation (P_compute, "deltaFrame");
       compU_showWraps = glGetUniformLocation (P_compute, "showWraps");
       compU_hasDoubleWidth = glGetUniformLocation (P_compute, "hasDoubleWidth");
+      compU_originChars = glGetUniformLocation (P_compute, "originChars");
 
       logT << "compute program:"
            << " uniform glyphPixels=" << compU_glyphPixels
@@ -679,12 +1509,12 @@ namespace zutty
            << " deltaFrame=" << compU_deltaFrame
            << " showWraps=" << compU_showWraps
            << " hasDoubleWidth=" << compU_hasDoubleWidth
+           << " originChars=" << compU_originChars
            << std::endl;
 
-      P_draw = glCreateProgram ();
-      glAttachShader (P_draw, S_fragment);
-      glAttachShader (P_draw, S_vertex);
-      linkProgram (P_draw, "draw");
+      P_draw = makeProgram (
+         "draw", {{GL_FRAGMENT_SHADER, fragmentShaderSource, "fragment"},
+                  {GL_VERTEX_SHADER, vertexShaderSource, "vertex"}});
       glUseProgram (P_draw);
 
       A_pos = glGetAttribLocation (P_draw, "pos");
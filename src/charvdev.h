@@ -12,6 +12,7 @@
 #pragma once
 
 #include "base.h"
+#include "colortab.h"
 #include "fontpack.h"
 #include "gl.h"
 #include "options.h"
@@ -20,6 +21,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace zutty
 {
@@ -31,7 +33,16 @@ namespace zutty
       ~CharVdev ();
 
       bool resize (uint16_t pxWidth_, uint16_t pxHeight_);
-      void draw ();
+
+      // Returns false if a delta frame had nothing to redraw
+      bool draw ();
+
+      // Rectangles (x, y, width, height) of the window redrawn by the last
+      // draw (), as expected by eglSwapBuffersWithDamage; empty if all.
+      const std::vector <EGLint>& getSwapDamage () const
+      {
+         return swapDamage;
+      };
 
       struct Cell
       {
@@ -43,21 +54,17 @@ namespace zutty
          uint8_t underline: 1;
          uint8_t inverse: 1;
          uint8_t wrap: 1;
-         uint8_t dirty: 1;
-         uint16_t _fill0: 8;
-         Color fg;
-         uint8_t _fill1;
-         Color bg;
-         uint8_t _fill2;
+         uint8_t _fill1: 1;
+         uint8_t _fill0;
+         uint16_t fg; // codes of colors, see internColor
+         uint16_t bg;
 
          Cell ():
             dwidth (0), dwidth_cont (0),
             bold (0), italic (0), underline (0), inverse (0), wrap (0),
-            dirty (0), fg (opts.fg), bg (opts.bg)
+            _fill1 (0), _fill0 (0), fg (Default_Fg_Code), bg (Default_Bg_Code)
          {}
 
-         using Ptr = std::shared_ptr <Cell>;
-
          bool operator == (const Cell& rhs) const
          {
             return memcmp (this, &rhs, sizeof (Cell)) == 0;
@@ -68,25 +75,22 @@ namespace zutty
             return ! operator == (rhs);
          }
       };
-      static_assert (sizeof (Cell) == 12, "Cell size mismatch");
-
-      static Cell::Ptr make_cells (uint16_t nCols, uint16_t nRows)
-      {
-         return std::shared_ptr <Cell> (new Cell [nRows * nCols],
-                                        std::default_delete <Cell []> ());
-      }
+      static_assert (sizeof (Cell) == 8, "Cell size mismatch");
 
-      struct Mapping
+      // Columns [start, end) of a row; none if start == end
+      struct RowSpan
       {
-         Mapping (uint16_t nCols_, uint16_t nRows_, Cell *& cells_);
-         ~Mapping ();
-
-         uint16_t nCols;
-         uint16_t nRows;
-         Cell *& cells;
+         uint16_t start = 0;
+         uint16_t end = 0;
       };
 
-      Mapping getMapping ();
+      // Upload the cells of the next frame to draw. In a delta frame,
+      // only cells within the damaged span of each row are checked for
+      // changes relative to the previous upload. Returns false if the
+      // frame had to be uploaded in full instead, so it must not be drawn
+      // as a delta frame.
+      bool setCells (uint16_t nCols_, uint16_t nRows_,
+                     const Cell* cells, const RowSpan* damage, bool delta);
 
       struct Cursor
       {
@@ -107,6 +111,10 @@ namespace zutty
       void setSelection (const Rect& selection);
       void setDeltaFrame (bool delta);
 
+      // Text (ASCII) shown in reverse video over the right end of the top
+      // row, from the next setCells () on; none if empty.
+      void setOverlay (const std::string& text);
+
    private:
       uint16_t px;
       uint16_t py;
@@ -115,10 +123,13 @@ namespace zutty
       uint16_t pxWidth;
       uint16_t pxHeight;
       bool hasDoubleWidth = false;
+      uint16_t tileCols = 0; // size of workgroups in cells, if tiled
+      uint16_t tileRows = 0;
 
       // GL ids of programs, buffers, textures, attributes and uniforms:
       GLuint P_compute, P_draw;
       GLuint B_text = 0;
+      GLuint B_colors = 0;
       GLuint T_atlas = 0;
       GLuint T_atlasMap = 0;
       GLuint T_atlas_dw = 0;
@@ -129,11 +140,90 @@ namespace zutty
       GLint compU_cursorPos, compU_cursorStyle;
       GLint compU_selectRect, compU_selectRectMode, compU_selectDamage;
       GLint compU_deltaFrame, compU_showWraps, compU_hasDoubleWidth;
+      GLint compU_originChars;
       GLint drawU_viewPixels;
 
-      Cell * cells = nullptr; // valid pointer if mapped, else nullptr
-
+      // Cell storage is a ring of regions, each holding the cells followed
+      // by a bitmap of cells changed since the previous frame. If buffer
+      // storage is supported, the ring is mapped persistently and a fence
+      // guards each region against overwrites while the GPU still uses it.
+      // Otherwise, there is a single region written via glBufferSubData.
+      // If a fence fails or is not signaled within fenceTimeout, reuse of
+      // the region is given up on, and cell storage falls back to that.
+      struct Region
+      {
+         GLsync fence = nullptr;
+         std::vector <uint8_t> staleRows; // rows to be copied on next use
+      };
+      constexpr const static int maxRegions = 3;
+      constexpr const static GLuint64 fenceTimeout = 2000000000; // ns
+      bool waitForRegion ();
+      Region regions [maxRegions];
+      int nRegions = 1;
+      int curRegion = 0;
+      size_t cellsBytes = 0;  // size of cells in a region (aligned)
+      size_t regionBytes = 0; // size of a region (aligned)
+      uint8_t* mapped = nullptr;
+      PFNGLBUFFERSTORAGEEXTPROC bufferStorage = nullptr;
+
+      // Atlas state for fonts with glyphs loaded on demand. Glyphs shown
+      // in any cell are never evicted; of the others, the one gone from
+      // the screen the longest is evicted first. The slots that may be
+      // taken are kept in a ring (through an extra entry past the last
+      // slot) in the order to take them, so a glyph loads in O(1).
+      struct GlyphCache
+      {
+         bool lazy = false;
+         bool dwidth = false;
+         Font::AtlasPos missing;           // shown if not (yet) loaded
+         std::vector <int32_t> slotChar;   // per slot: code point or -1
+         std::vector <uint8_t> slotPinned; // per slot: never evicted
+         std::vector <int32_t> slotPrev;   // per slot: -1 if not in ring
+         std::vector <int32_t> slotNext;
+         std::vector <uint16_t> charSlot;  // per code point: slot or 0
+         std::vector <uint32_t> useCount;  // per code point: cells in use
+      };
+      GlyphCache glyphs;
+      GlyphCache glyphs_dw;
+      Fontpack* lazyFonts = nullptr; // kept for loading glyphs on demand
+
+      uint32_t colorsUploaded = 0; // color table entries on the GPU
+      uint32_t colorsReused = 0;   // reuses of codes seen by the upload
+
+      std::vector <Cell> shadow; // cells as last uploaded
+      std::vector <uint32_t> dirtyMask;
+
+      // Per row: columns to be redrawn in a delta frame
+      std::vector <RowSpan> drawSpans;
+      std::vector <EGLint> swapDamage;
+      bool deltaFrame = false;
+
+      std::string overlay;
+      uint16_t overlayX = 0; // first column covered by the overlay shown
+
+      // GL_TIME_ELAPSED queries of the compute and draw passes of a frame,
+      // if supported and counting is enabled. While pending, the results
+      // are read in a later frame, not to stall the pipeline waiting.
+      GLuint Q_timers [2] = {0, 0};
+      bool timersPending = false;
+
+      void initGlyphCache (GlyphCache& gc, const Font& fnt, bool dwidth);
+      void linkSlot (GlyphCache& gc, int slot);
+      void unlinkSlot (GlyphCache& gc, int slot);
+      void resetGlyphUse (GlyphCache& gc);
+      void trackGlyph (const Cell& cell, bool shown);
+      void loadGlyph (GlyphCache& gc, uint16_t c);
+      void setAtlasMapEntry (const GlyphCache& gc, uint16_t c,
+                             const Font::AtlasPos& apos);
+      bool chooseTiles ();
       void createShaders ();
+      void setupCellStorage ();
+      void upload (size_t offset, const void* data, size_t size);
+      void uploadColors ();
+      void addDrawSpan (int pY, int startX, int endX);
+      void applyOverlay (const Cell* cells);
+      void collectGpuTimes ();
+      void dispatch (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
    };
 
 } // namespace zutty
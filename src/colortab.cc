@@ -0,0 +1,262 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#include "colortab.h"
+#include "options.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace
+{
+   using namespace zutty;
+
+   constexpr const uint16_t Coarse_Code_Base = 2;
+   constexpr const uint32_t Coarse_Code_Count = 16 * 16 * 16;
+   constexpr const uint32_t Truecolor_Code_Base =
+      Coarse_Code_Base + Coarse_Code_Count;
+
+   inline uint32_t
+   pack (const Color& c)
+   {
+      return c.red | c.green << 8 | c.blue << 16;
+   }
+
+   inline Color
+   unpack (uint32_t rgb)
+   {
+      return Color {(uint8_t) rgb, (uint8_t) (rgb >> 8),
+                    (uint8_t) (rgb >> 16)};
+   }
+
+   inline uint16_t
+   coarse (uint8_t v)
+   {
+      return (v * 15 + 127) / 255;
+   }
+
+   // Code of the color with 4 bits per channel nearest to c
+   inline uint16_t
+   coarseCode (const Color& c)
+   {
+      return Coarse_Code_Base +
+         (coarse (c.red) | coarse (c.green) << 4 | coarse (c.blue) << 8);
+   }
+
+   // The coarse colors are spread over the full range of each channel,
+   // so that black and white (among others) are represented exactly.
+   inline Color
+   coarseColor (uint16_t code)
+   {
+      const uint16_t n = code - Coarse_Code_Base;
+      return Color {(uint8_t) ((n & 0xf) * 0x11),
+                    (uint8_t) ((n >> 4 & 0xf) * 0x11),
+                    (uint8_t) ((n >> 8 & 0xf) * 0x11)};
+   }
+
+   // Entries are appended, and are published (with the count of codes)
+   // to the threads reading them. Entries of freed codes are changed in
+   // place when these are reused, as published by the count of reuses.
+   std::atomic <uint32_t> truecolors [Color_Code_Count - Truecolor_Code_Base];
+   std::atomic <uint32_t> codeCount {Truecolor_Code_Base};
+   std::atomic <uint32_t> reuseCount {0};
+
+   inline uint32_t
+   truecolor (uint16_t code)
+   {
+      return truecolors [code - Truecolor_Code_Base].load (
+         std::memory_order_relaxed);
+   }
+
+   // Index of truecolor codes by color: open addressing with linear
+   // probing, at most half full. Zero marks a free slot (no truecolor
+   // code is zero); programs cycling through colors do not allocate.
+   constexpr const int Index_Bits = 17;
+   constexpr const uint32_t Index_Mask = (1 << Index_Bits) - 1;
+   uint16_t truecolorIndex [1 << Index_Bits];
+
+   inline uint32_t
+   indexSlot (uint32_t rgb)
+   {
+      return (rgb * 2654435761u) >> (32 - Index_Bits);
+   }
+
+   // Find the code of rgb, or the free slot to put it in (returning 0)
+   inline uint16_t
+   lookup (uint32_t rgb, uint32_t& slot)
+   {
+      for (slot = indexSlot (rgb); truecolorIndex [slot];
+           slot = (slot + 1) & Index_Mask)
+      {
+         const uint16_t code = truecolorIndex [slot];
+         if (truecolor (code) == rgb)
+            return code;
+      }
+      return 0;
+   }
+
+   /* Codes freed by the last sweep, to be reused. A sweep freeing fewer
+    * than Min_Free_Codes is not repeated until some more colors have
+    * missed out on a code: Min_Sweep_Delay at first, twice as many after
+    * each further such sweep. The cost of sweeping (marking all cells)
+    * thus stays small per color interned, even while (nearly) all codes
+    * are in use for long.
+    */
+   constexpr const size_t Min_Free_Codes = 1024;
+   constexpr const uint32_t Min_Sweep_Delay = 4096;
+   constexpr const uint32_t Max_Sweep_Delay = 1 << 24;
+   std::vector <uint16_t> freeCodes;
+   uint32_t sweepDelay = 0;     // misses left until the next sweep
+   uint32_t nextSweepDelay = Min_Sweep_Delay;
+   ColorSweepFn sweepFn;
+
+   void
+   sweepCodes ()
+   {
+      std::vector <bool> used (Color_Code_Count);
+      sweepFn (used);
+
+      freeCodes.clear ();
+      std::fill (truecolorIndex, truecolorIndex + (1 << Index_Bits), 0);
+      for (uint32_t code = Color_Code_Count - 1; code >= Truecolor_Code_Base;
+           --code)
+      {
+         if (!used [code])
+         {
+            freeCodes.push_back (code);
+            continue;
+         }
+         uint32_t slot;
+         lookup (truecolor (code), slot);
+         truecolorIndex [slot] = code;
+      }
+
+      if (freeCodes.size () < Min_Free_Codes)
+      {
+         sweepDelay = nextSweepDelay;
+         nextSweepDelay = std::min (2 * nextSweepDelay, Max_Sweep_Delay);
+      }
+      else
+         nextSweepDelay = Min_Sweep_Delay;
+   }
+
+   // Give a freed code (if there is one) to rgb, which is not in the table
+   inline uint16_t
+   reuseCode (uint32_t rgb)
+   {
+      if (freeCodes.empty ())
+      {
+         if (!sweepFn || sweepDelay)
+         {
+            if (sweepDelay)
+               --sweepDelay;
+            return 0;
+         }
+         sweepCodes ();
+         if (freeCodes.empty ())
+            return 0;
+      }
+
+      uint32_t slot;
+      lookup (rgb, slot);
+      const uint16_t code = freeCodes.back ();
+      freeCodes.pop_back ();
+      truecolors [code - Truecolor_Code_Base].store (
+         rgb, std::memory_order_relaxed);
+      reuseCount.fetch_add (1, std::memory_order_release);
+      return truecolorIndex [slot] = code;
+   }
+
+   // Most lines of output use only a few colors, in turn
+   uint32_t lastRgb = 0xffffffff;
+   uint16_t lastCode = 0;
+
+} // namespace
+
+namespace zutty
+{
+   uint16_t
+   internColor (const Color& color)
+   {
+      const uint32_t rgb = pack (color);
+      if (rgb == lastRgb)
+         return lastCode;
+
+      uint16_t code;
+      if (color == opts.fg)
+         code = Default_Fg_Code;
+      else if (color == opts.bg)
+         code = Default_Bg_Code;
+      else if (coarseColor (coarseCode (color)) == color)
+         code = coarseCode (color);
+      else
+      {
+         uint32_t slot;
+         const uint32_t n = codeCount.load (std::memory_order_relaxed);
+         code = lookup (rgb, slot);
+         if (code == 0 && n == Color_Code_Count)
+         {
+            code = reuseCode (rgb);
+            if (code == 0)
+               code = coarseCode (color);
+         }
+         else if (code == 0)
+         {
+            truecolors [n - Truecolor_Code_Base].store (
+               rgb, std::memory_order_relaxed);
+            codeCount.store (n + 1, std::memory_order_release);
+            code = truecolorIndex [slot] = n;
+         }
+      }
+
+      lastRgb = rgb;
+      lastCode = code;
+      return code;
+   }
+
+   Color
+   resolveColor (uint16_t code)
+   {
+      if (code == Default_Fg_Code)
+         return opts.fg;
+      else if (code == Default_Bg_Code)
+         return opts.bg;
+      else if (code < Truecolor_Code_Base)
+         return coarseColor (code);
+      return unpack (truecolor (code));
+   }
+
+   void
+   setColorSweep (const ColorSweepFn& sweep)
+   {
+      sweepFn = sweep;
+   }
+
+   uint32_t
+   getColorCount ()
+   {
+      return codeCount.load (std::memory_order_acquire);
+   }
+
+   uint32_t
+   getColorReuseCount ()
+   {
+      return reuseCount.load (std::memory_order_acquire);
+   }
+
+   uint32_t
+   getColorEntry (uint16_t code)
+   {
+      return pack (resolveColor (code));
+   }
+
+} // namespace zutty
@@ -0,0 +1,65 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#pragma once
+
+#include "base.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace zutty
+{
+   /* Cells refer to their colors by 16-bit codes into a table of colors,
+    * which is shared by all frames (and the scrollback) and mirrored to
+    * the GPU. Since only a small number of distinct colors is in use at
+    * any time, this keeps cells at 8 bytes instead of 12.
+    *
+    * Codes of the default fg and bg are fixed, and resolve to opts.fg
+    * and opts.bg. Next come codes of colors with 4 bits per channel, and
+    * then the truecolor codes, allocated as new colors are first used.
+    * Once these run out, the codes no longer used by any cell (as marked
+    * by the sweep function set below) are freed, to be given to new
+    * colors in turn. Only while too few of them are free do new colors
+    * get the code of their 4-bit approximation instead.
+    */
+   constexpr const uint16_t Default_Fg_Code = 0;
+   constexpr const uint16_t Default_Bg_Code = 1;
+   constexpr const uint32_t Color_Code_Count = 0x10000;
+
+   // Return the code of a color; to be called only from the thread
+   // processing terminal input.
+   uint16_t internColor (const Color& color);
+
+   /* Set the function marking the codes in use (used [code] = true) by
+    * all cells, called by internColor when the table is full. Codes
+    * marked stay valid; all others are freed, to be reused.
+    */
+   using ColorSweepFn = std::function <void (std::vector <bool>& used)>;
+   void setColorSweep (const ColorSweepFn& sweep);
+
+   // Return the color of a code (the inverse of the above)
+   Color resolveColor (uint16_t code);
+
+   // The number of codes in use (valid to resolve) so far, for uploading
+   // new table entries. It may be called from any thread, with entries
+   // below the count returned safe to read.
+   uint32_t getColorCount ();
+
+   // The number of times codes below the count were given new colors
+   // (after being freed); each time, all entries are to be uploaded anew.
+   uint32_t getColorReuseCount ();
+
+   // Table entry of a code, as stored on the GPU: 0x00bbggrr
+   uint32_t getColorEntry (uint16_t code);
+
+} // namespace zutty
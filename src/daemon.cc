@@ -0,0 +1,352 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#include "daemon.h"
+#include "log.h"
+#include "options.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(SOLARIS)
+#include <ucred.h>
+#endif
+
+extern char** environ;
+
+namespace
+{
+   using namespace zutty;
+
+   // Requests larger than this are rejected (a sane one is a few KiB)
+   constexpr const size_t maxRequest = 1 << 20;
+
+   const char* const okReply = "ok";
+
+   bool
+   writeAll (int fd, const char* buf, size_t len)
+   {
+      while (len)
+      {
+         ssize_t n = write (fd, buf, len);
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n <= 0)
+            return false;
+         buf += n;
+         len -= n;
+      }
+      return true;
+   }
+
+   // Is the peer of the connection a process of the user running us?
+   bool
+   isOwnUser (int conn)
+   {
+      uid_t uid;
+   #if defined(LINUX)
+      ucred cred;
+      socklen_t len = sizeof (cred);
+      if (getsockopt (conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+      {
+         SYS_WARN ("getsockopt(SO_PEERCRED)");
+         return false;
+      }
+      uid = cred.uid;
+   #elif defined(SOLARIS)
+      ucred_t* cred = nullptr;
+      if (getpeerucred (conn, &cred) < 0)
+      {
+         SYS_WARN ("getpeerucred()");
+         return false;
+      }
+      uid = ucred_geteuid (cred);
+      ucred_free (cred);
+   #else
+      gid_t gid;
+      if (getpeereid (conn, &uid, &gid) < 0)
+      {
+         SYS_WARN ("getpeereid()");
+         return false;
+      }
+   #endif
+      if (uid != getuid ())
+      {
+         logW << "Dropped connection of uid " << uid << std::endl;
+         return false;
+      }
+      return true;
+   }
+
+   bool
+   readAll (int fd, std::string& out)
+   {
+      char buf [4096];
+      while (1)
+      {
+         ssize_t n = read (fd, buf, sizeof (buf));
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n < 0 || out.size () + n > maxRequest)
+            return false;
+         if (n == 0)
+            return true;
+         out.append (buf, n);
+      }
+   }
+
+   bool
+   makeAddress (const std::string& path, sockaddr_un& addr)
+   {
+      memset (&addr, 0, sizeof (addr));
+      addr.sun_family = AF_UNIX;
+      if (path.empty () || path.size () >= sizeof (addr.sun_path))
+         return false;
+      memcpy (addr.sun_path, path.c_str (), path.size () + 1);
+      return true;
+   }
+
+   // A socket connected to the daemon at path, or -1 if there is none
+   int
+   connectDaemon (const std::string& path)
+   {
+      sockaddr_un addr;
+      if (!makeAddress (path, addr))
+         return -1;
+
+      int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0)
+         return -1;
+      if (connect (fd, (const sockaddr*) &addr, sizeof (addr)) < 0)
+      {
+         close (fd);
+         return -1;
+      }
+      return fd;
+   }
+
+   /* A request is a sequence of NUL-terminated strings: the number of
+    * arguments, the working directory, the arguments, and then the
+    * environment of the client (any number of strings, up to the end).
+    */
+   std::string
+   makeRequest (const std::vector <std::string>& args)
+   {
+      char cwd [PATH_MAX];
+      if (!getcwd (cwd, sizeof (cwd)))
+         strcpy (cwd, "/");
+
+      std::string req = std::to_string (args.size ());
+      req.push_back ('\0');
+      req.append (cwd).push_back ('\0');
+      for (const auto& arg: args)
+         req.append (arg).push_back ('\0');
+      for (char** env = environ; *env; ++env)
+         req.append (*env).push_back ('\0');
+      return req;
+   }
+
+   bool
+   parseRequest (const std::string& req, std::string& cwd,
+                 std::vector <std::string>& args,
+                 std::vector <std::string>& env)
+   {
+      std::vector <std::string> strs;
+      for (size_t pos = 0; pos < req.size (); )
+      {
+         size_t end = req.find ('\0', pos);
+         if (end == std::string::npos)
+            return false;
+         strs.emplace_back (req, pos, end - pos);
+         pos = end + 1;
+      }
+
+      char* endp = nullptr;
+      if (strs.size () < 2)
+         return false;
+      const unsigned long nArgs = strtoul (strs [0].c_str (), &endp, 10);
+      if (*endp || nArgs > strs.size () - 2)
+         return false;
+
+      cwd = strs [1];
+      args.assign (strs.begin () + 2, strs.begin () + 2 + nArgs);
+      env.assign (strs.begin () + 2 + nArgs, strs.end ());
+      return true;
+   }
+
+   // Make the environment of the client that of this process
+   void
+   setEnvironment (const std::vector <std::string>& env)
+   {
+      // N.B.: these strings become part of the environment for good
+      static std::vector <char*> envp;
+      envp.clear ();
+      for (const auto& e: env)
+         envp.push_back (strdup (e.c_str ()));
+      envp.push_back (nullptr);
+      environ = envp.data ();
+   }
+
+} // namespace
+
+namespace zutty
+{
+   std::string
+   daemonSocketPath (const char* display)
+   {
+      std::string dir;
+      const char* runtimeDir = getenv ("XDG_RUNTIME_DIR");
+      if (runtimeDir && *runtimeDir)
+         dir = runtimeDir;
+      else
+      {
+         // The directory must be ours alone, not to let others in
+         dir = "/tmp/zutty-" + std::to_string (getuid ());
+         mkdir (dir.c_str (), 0700);
+         struct stat st;
+         if (lstat (dir.c_str (), &st) < 0 || !S_ISDIR (st.st_mode) ||
+             st.st_uid != getuid () || (st.st_mode & 077))
+         {
+            logE << "Unsafe daemon socket directory " << dir << std::endl;
+            return "";
+         }
+      }
+
+      std::string name = display ? display : "";
+      for (char& c: name)
+         if (c == '/')
+            c = '_';
+      return dir + "/zutty" + name + ".sock";
+   }
+
+   int
+   runClient (const std::vector <std::string>& args)
+   {
+      const std::string path = daemonSocketPath (opts.display);
+      int fd = connectDaemon (path);
+      if (fd < 0)
+      {
+         logE << "No Zutty daemon listening on " << path << std::endl;
+         return 1;
+      }
+
+      const std::string req = makeRequest (args);
+      std::string reply;
+      bool ok = writeAll (fd, req.data (), req.size ()) &&
+         shutdown (fd, SHUT_WR) == 0 && readAll (fd, reply);
+      close (fd);
+
+      if (!ok || reply != okReply)
+      {
+         logE << "Zutty daemon failed to open a window"
+              << (reply.empty () ? "" : ": ") << reply << std::endl;
+         return 1;
+      }
+      return 0;
+   }
+
+   std::vector <std::string>
+   serveWindows ()
+   {
+      const std::string path = daemonSocketPath (opts.display);
+      sockaddr_un addr;
+      if (!makeAddress (path, addr))
+      {
+         logE << "Invalid daemon socket path: " << path << std::endl;
+         exit (1);
+      }
+
+      int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0)
+         SYS_ERROR ("socket()");
+      fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+      if (bind (fd, (const sockaddr*) &addr, sizeof (addr)) < 0)
+      {
+         // Take over the socket left over by a daemon no longer running
+         int other = errno == EADDRINUSE ? connectDaemon (path) : -1;
+         if (other >= 0)
+         {
+            close (other);
+            logE << "Zutty daemon already listening on " << path
+                 << std::endl;
+            exit (1);
+         }
+         unlink (path.c_str ());
+         if (bind (fd, (const sockaddr*) &addr, sizeof (addr)) < 0)
+            SYS_ERROR ("bind(", path, ")");
+      }
+      if (listen (fd, 16) < 0)
+         SYS_ERROR ("listen()");
+
+      // The window processes are never waited for; let them be reaped
+      signal (SIGCHLD, SIG_IGN);
+      logI << "Listening on " << path << std::endl;
+
+      while (1)
+      {
+         int conn = accept (fd, nullptr, nullptr);
+         if (conn < 0)
+         {
+            if (errno == EINTR || errno == ECONNABORTED)
+               continue;
+            SYS_ERROR ("accept()");
+         }
+
+         // The request sets the command, directory and environment of
+         // the window, so it is only taken from our own user
+         if (!isOwnUser (conn))
+         {
+            close (conn);
+            continue;
+         }
+
+         pid_t pid = fork ();
+         if (pid < 0)
+            SYS_WARN ("fork()");
+         if (pid != 0)
+         {
+            close (conn);
+            continue;
+         }
+
+         // In the process of the new window from here on; in a session
+         // of its own, so that it lives on if the daemon is interrupted
+         close (fd);
+         signal (SIGCHLD, SIG_DFL);
+         setsid ();
+
+         std::string req, cwd;
+         std::vector <std::string> args, env;
+         if (!readAll (conn, req) || !parseRequest (req, cwd, args, env))
+         {
+            const char* err = "invalid request";
+            writeAll (conn, err, strlen (err));
+            _exit (1);
+         }
+         if (chdir (cwd.c_str ()) < 0)
+            SYS_WARN ("chdir(", cwd, ")");
+         setEnvironment (env);
+
+         writeAll (conn, okReply, strlen (okReply));
+         close (conn);
+         return args;
+      }
+   }
+
+} // namespace zutty
@@ -0,0 +1,39 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace zutty
+{
+   /* Daemon mode: a Zutty started with -daemon does the costly part of
+    * the startup (looking up and rasterizing the fonts) once, and forks a
+    * terminal process for each window asked for by zutty -client. The
+    * forked processes start out with the fonts already loaded, sharing
+    * their memory with the daemon until it gets written to.
+    */
+
+   // The socket of the daemon serving the given X display
+   std::string daemonSocketPath (const char* display);
+
+   // Ask the daemon to open a window, running with the given command
+   // line arguments, working directory and environment of the client.
+   // Returns the exit status of the client.
+   int runClient (const std::vector <std::string>& args);
+
+   // Serve requests for windows, forever. Returns only in the forked
+   // process of each window, with the working directory and environment
+   // of the client already set up, returning its command line arguments.
+   std::vector <std::string> serveWindows ();
+
+} // namespace zutty
@@ -14,8 +14,16 @@
 #include "options.h"
 #include "utf8.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <clocale>
 #include <cmath>
+#include <cstring>
+#include <functional>
 #include <limits>
 #include <sstream>
 #include <stdexcept>
@@ -40,6 +48,27 @@ std::string locateFontFile(FcPattern *pattern)
 
 constexpr unsigned int bytes_per_pixel = 4; // RGBA
 
+// Layout of an atlas cache file: the header is followed by the key,
+// the atlas map entries, the charset bits (if lazy) and the atlas data.
+constexpr const char atlasCacheMagic [8] = {'Z','A','T','L','S','0','0','1'};
+
+struct AtlasCacheHeader
+{
+   char magic [8];
+   uint32_t keySize;
+   uint32_t mapSize;
+   uint32_t charsetSize;
+   uint32_t atlasSize;
+   uint16_t px, py, baseline, nx, ny, atlas_seq;
+   int32_t loadSkipCount;
+};
+
+struct AtlasCacheEntry
+{
+   uint16_t code;
+   uint8_t x, y;
+};
+
 }
 
 namespace zutty
@@ -47,6 +76,7 @@ namespace zutty
    Font::Font (FcPattern* font_)
       : font (font_, [](FcPattern* p) { FcPatternDestroy(p); })
       , overlay (false)
+      , lazy (opts.atlasSize > 0)
    {
       load ();
    }
@@ -54,6 +84,7 @@ namespace zutty
    Font::Font (FcPattern* font_, const Font& priFont, Overlay_)
       : font (font_, [](FcPattern* p) { FcPatternDestroy(p); })
       , overlay (true)
+      , lazy (priFont.isLazy ())
       , px (priFont.getPx ())
       , py (priFont.getPy ())
       , baseline (priFont.getBaseline ())
@@ -61,6 +92,7 @@ namespace zutty
       , ny (priFont.getNy ())
       , atlasBuf (priFont.getAtlas ())
       , atlasMap (priFont.getAtlasMap ())
+      , cacheKey (priFont.cacheKey)
    {
       load ();
    }
@@ -68,15 +100,61 @@ namespace zutty
    Font::Font (FcPattern* font_, const Font& priFont, DoubleWidth_)
       : font (font_, [](FcPattern* p) { FcPatternDestroy(p); })
       , dwidth (true)
+      , lazy (priFont.isLazy ())
       , px (2 * priFont.getPx ())
       , py (priFont.getPy ())
+      , cacheKey (priFont.cacheKey)
    {
       load ();
    }
 
+   Font::~Font ()
+   {
+      if (ftFace)
+         FT_Done_Face (ftFace);
+      if (ftLib)
+         FT_Done_FreeType (ftLib);
+   }
+
+   bool Font::hasGlyph (uint16_t c) const
+   {
+      if (isAstralCode (c))
+      {
+         const FT_ULong cp = resolveCode (c);
+         return ftFace && isLoadableChar (cp) && FT_Get_Char_Index (ftFace, cp);
+      }
+      return c < charset.size () && charset [c];
+   }
+
+   const uint8_t* Font::getGlyphData (const AtlasPos& apos) const
+   {
+      return atlasBuf.data () + bytes_per_pixel * px *
+         (nx * py * apos.y + apos.x);
+   }
+
+   void Font::loadGlyph (uint16_t c, const AtlasPos& apos,
+                         const Font* fallback)
+   {
+      const size_t rowBytes = bytes_per_pixel * nx * px;
+      const size_t offset = getGlyphData (apos) - atlasBuf.data ();
+      for (int j = 0; j < py; ++j)
+      {
+         uint8_t* dst = atlasBuf.data () + offset + j * rowBytes;
+         if (fallback && !hasGlyph (c))
+            memcpy (dst, fallback->atlasBuf.data () + offset + j * rowBytes,
+                    bytes_per_pixel * px);
+         else
+            memset (dst, 0, bytes_per_pixel * px);
+      }
+
+      if (hasGlyph (c))
+         loadFace (ftFace, resolveCode (c), apos);
+      atlasMap [c] = apos;
+   }
+
    // private methods
 
-   bool Font::isLoadableChar (FT_ULong c)
+   bool Font::isLoadableChar (FT_ULong c) const
    {
       if (c == Missing_Glyph_Marker)
          return true;
@@ -88,6 +166,13 @@ namespace zutty
               (!dwidth && wcwidth (c) < 2));
    }
 
+   // With lazy loading, the glyphs to load up front
+   bool Font::isPreloadedChar (FT_ULong c)
+   {
+      return c < 0x100 ||
+         c == Missing_Glyph_Marker || c == Unicode_Replacement_Character;
+   }
+
    void Font::load ()
    {
       FT_Library ft;
@@ -186,17 +271,56 @@ namespace zutty
          glyph_render_mode = FT_RENDER_MODE_MONO;
       }
 
+      cacheKey = makeCacheKey (filename, pixelSize, lcd_filter);
+      std::string cachePath;
+      if (!cacheKey.empty () && !getCacheDir ().empty ())
+      {
+         std::ostringstream oss;
+         oss << getCacheDir () << "/atlas-" << std::hex
+             << std::hash <std::string> () (cacheKey);
+         cachePath = oss.str ();
+      }
+
+      if (!cachePath.empty () && loadCache (cachePath))
+      {
+         logT << "Loaded atlas from cache " << cachePath << std::endl;
+         if (lazy)
+         {
+            // The face is still needed to load glyphs on demand
+            if (face->num_fixed_sizes > 0)
+               loadFixed (face, pixelSize);
+            else
+               loadScaled (face, pixelSize);
+            FT_Library_SetLcdFilter(ft, (FT_LcdFilter)lcd_filter);
+            ftLib = ft;
+            ftFace = face;
+         }
+         else
+         {
+            FT_Done_Face (face);
+            FT_Done_FreeType (ft);
+         }
+         return;
+      }
+
       /* Determine the number of glyphs to actually load, based on wcwidth ()
        * We need this number up front to compute the atlas geometry.
        */
       int num_glyphs = 0;
       {
+         if (lazy)
+            charset.resize (std::numeric_limits<uint16_t>::max () + 1);
+
          FT_UInt gindex;
          FT_ULong charcode = FT_Get_First_Char (face, &gindex);
          while (gindex != 0)
          {
             if (isLoadableChar (charcode))
+            {
                ++ num_glyphs;
+               if (lazy && charcode < charset.size ())
+                  charset [charcode] = true;
+            }
             charcode = FT_Get_Next_Char (face, charcode, &gindex);
          }
       }
@@ -223,6 +347,9 @@ namespace zutty
       if (!overlay)
       {
          unsigned n_glyphs = num_glyphs + 1;
+         if (lazy)
+            n_glyphs = std::min (n_glyphs,
+                                 std::max (256u, (unsigned) opts.atlasSize));
          unsigned long total_pixels = n_glyphs * px * py;
          double side = sqrt (total_pixels);
          nx = side / px;
@@ -268,12 +395,17 @@ namespace zutty
             if (overlay)
             {
                const auto& it = atlasMap.find (charcode);
-               if (it != atlasMap.end ())
+               if (charcode <= std::numeric_limits<uint16_t>::max () &&
+                   it != atlasMap.end ())
                {
                   loadFace (face, charcode, it->second);
                }
             }
-            else
+            else if (!lazy)
+            {
+               loadFace (face, charcode);
+            }
+            else if (isPreloadedChar (charcode) && atlas_seq < nx * ny)
             {
                loadFace (face, charcode);
             }
@@ -288,8 +420,147 @@ namespace zutty
               << std::endl;
       }
 
-      FT_Done_Face (face);
-      FT_Done_FreeType (ft);
+      if (!cachePath.empty ())
+         saveCache (cachePath);
+
+      if (lazy)
+      {
+         ftLib = ft;
+         ftFace = face;
+      }
+      else
+      {
+         FT_Done_Face (face);
+         FT_Done_FreeType (ft);
+      }
+   }
+
+   std::string Font::makeCacheKey (const std::string& filename,
+                                   int pixelSize, int lcdFilter) const
+   {
+      struct stat st;
+      if (stat (filename.c_str (), &st) < 0)
+         return "";
+
+      // Overlay and double-width atlases depend on the primary font
+      if ((overlay || dwidth) && cacheKey.empty ())
+         return "";
+
+      std::ostringstream oss;
+      oss << filename << ':' << st.st_mtime << ':' << st.st_size
+          << ':' << (overlay ? "overlay" : (dwidth ? "dwidth" : "primary"))
+          << ':' << pixelSize << ':' << glyph_load_flags
+          << ':' << glyph_render_mode << ':' << lcdFilter
+          << ':' << (lazy ? opts.atlasSize : 0)
+          << ':' << setlocale (LC_CTYPE, nullptr); // affects wcwidth ()
+      if (overlay || dwidth)
+         oss << '|' << cacheKey;
+      return oss.str ();
+   }
+
+   bool Font::loadCache (const std::string& path)
+   {
+      int fd = open (path.c_str (), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+         return false;
+
+      struct stat st;
+      if (fstat (fd, &st) < 0 ||
+          (size_t) st.st_size < sizeof (AtlasCacheHeader))
+      {
+         close (fd);
+         return false;
+      }
+
+      void* data = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close (fd);
+      if (data == MAP_FAILED)
+         return false;
+
+      bool ok = readCache ((const uint8_t*) data, st.st_size);
+      munmap (data, st.st_size);
+      if (!ok)
+         logT << "Ignoring stale or invalid atlas cache " << path << std::endl;
+      return ok;
+   }
+
+   bool Font::readCache (const uint8_t* data, size_t size)
+   {
+      AtlasCacheHeader hdr;
+      memcpy (&hdr, data, sizeof (hdr));
+      const size_t expectedSize = sizeof (hdr) + hdr.keySize +
+         hdr.mapSize * sizeof (AtlasCacheEntry) + hdr.charsetSize +
+         hdr.atlasSize;
+      if (memcmp (hdr.magic, atlasCacheMagic, sizeof (hdr.magic)) ||
+          size != expectedSize ||
+          cacheKey.compare (0, std::string::npos,
+                            (const char*) data + sizeof (hdr), hdr.keySize) ||
+          hdr.atlasSize != bytes_per_pixel * hdr.nx * hdr.px * hdr.ny * hdr.py)
+         return false;
+
+      if ((overlay || dwidth) && (hdr.px != px || hdr.py != py))
+         return false;
+
+      const uint8_t* p = data + sizeof (hdr) + hdr.keySize;
+      atlasMap.clear ();
+      for (uint32_t k = 0; k < hdr.mapSize; ++k)
+      {
+         AtlasCacheEntry entry;
+         memcpy (&entry, p, sizeof (entry));
+         p += sizeof (entry);
+         atlasMap [entry.code] = {entry.x, entry.y};
+      }
+
+      charset.assign (8 * hdr.charsetSize, false);
+      for (size_t k = 0; k < charset.size (); ++k)
+         charset [k] = p [k >> 3] & (1 << (k & 7));
+      p += hdr.charsetSize;
+
+      atlasBuf.assign (p, p + hdr.atlasSize);
+
+      px = hdr.px;
+      py = hdr.py;
+      baseline = hdr.baseline;
+      nx = hdr.nx;
+      ny = hdr.ny;
+      atlas_seq = hdr.atlas_seq;
+      loadSkipCount = hdr.loadSkipCount;
+      return true;
+   }
+
+   void Font::saveCache (const std::string& path) const
+   {
+      AtlasCacheHeader hdr;
+      memset (&hdr, 0, sizeof (hdr));
+      memcpy (hdr.magic, atlasCacheMagic, sizeof (hdr.magic));
+      hdr.keySize = cacheKey.size ();
+      hdr.mapSize = atlasMap.size ();
+      hdr.charsetSize = (charset.size () + 7) / 8;
+      hdr.atlasSize = atlasBuf.size ();
+      hdr.px = px;
+      hdr.py = py;
+      hdr.baseline = baseline;
+      hdr.nx = nx;
+      hdr.ny = ny;
+      hdr.atlas_seq = atlas_seq;
+      hdr.loadSkipCount = loadSkipCount;
+
+      std::vector <uint8_t> bits (hdr.charsetSize, 0);
+      for (size_t k = 0; k < charset.size (); ++k)
+         if (charset [k])
+            bits [k >> 3] |= 1 << (k & 7);
+
+      std::string data ((const char*) &hdr, sizeof (hdr));
+      data.append (cacheKey);
+      for (const auto& it: atlasMap)
+      {
+         const AtlasCacheEntry entry = {it.first, it.second.x, it.second.y};
+         data.append ((const char*) &entry, sizeof (entry));
+      }
+      data.append ((const char*) bits.data (), bits.size ());
+      data.append ((const char*) atlasBuf.data (), atlasBuf.size ());
+      if (writeCacheFile (path, data.data (), data.size ()))
+         logT << "Saved atlas to cache " << path << std::endl;
    }
 
    void Font::loadFixed (const FT_Face& face, int pixelSize)
@@ -381,6 +652,17 @@ namespace zutty
 
    void Font::loadFace (const FT_Face& face, FT_ULong c)
    {
+      // Glyphs outside the BMP are loaded on demand, if at all
+      if (c > std::numeric_limits<uint16_t>::max ())
+      {
+        #ifdef DEBUG
+         logT << "Skip loading code point 0x" << std::hex << c << std::dec
+              << " outside the Basic Multilingual Plane" << std::endl;
+        #endif
+         ++loadSkipCount;
+         return;
+      }
+
       const uint8_t atlas_row = atlas_seq / nx;
       const uint8_t atlas_col = atlas_seq - nx * atlas_row;
       const AtlasPos apos = {atlas_col, atlas_row};
@@ -392,16 +674,6 @@ namespace zutty
 
    void Font::loadFace (const FT_Face& face, FT_ULong c, const AtlasPos& apos)
    {
-      if (c > std::numeric_limits<uint16_t>::max ())
-      {
-        #ifdef DEBUG
-         logT << "Skip loading code point 0x" << std::hex << c << std::dec
-              << " outside the Basic Multilingual Plane" << std::endl;
-        #endif
-         ++loadSkipCount;
-         return;
-      }
-
       if (FT_Load_Char (face, c, glyph_load_flags))
       {
          logW << "Failed to load glyph for char " << c << std::endl;
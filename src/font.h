@@ -56,7 +56,7 @@ namespace zutty
        */
       Font (FcPattern* font, const Font& priFont, DoubleWidth_);
 
-      ~Font () = default;
+      ~Font ();
 
       uint16_t getPx () const { return px; };
       uint16_t getPy () const { return py; };
@@ -75,10 +75,29 @@ namespace zutty
       using AtlasMap = std::map <uint16_t, AtlasPos>;
       const AtlasMap& getAtlasMap () const { return atlasMap; };
 
+      /* With a limited atlas size (see the atlasSize option), only a
+       * basic set of glyphs is loaded up front, and the font is kept open
+       * for loading the rest on demand, evicting glyphs no longer in use.
+       */
+      bool isLazy () const { return lazy; };
+      bool hasGlyph (uint16_t c) const;
+      const uint8_t* getGlyphData (const AtlasPos& apos) const;
+
+      /* Load the glyph of c into an atlas position, replacing the glyph
+       * previously there. If c has no glyph in this font, the glyph at the
+       * same position in the fallback font (if any) is copied instead.
+       */
+      void loadGlyph (uint16_t c, const AtlasPos& apos, const Font* fallback);
+      void unloadGlyph (uint16_t c) { atlasMap.erase (c); };
+
    private:
       std::shared_ptr<FcPattern> font;
       bool overlay = false;
       bool dwidth = false;
+      bool lazy = false;
+      FT_Library ftLib = nullptr; // kept open if lazy
+      FT_Face ftFace = nullptr;
+      std::vector <bool> charset; // loadable code points, if lazy
       int glyph_load_flags = 0;
       FT_Render_Mode glyph_render_mode;
       uint16_t px = 0; // glyph width in pixels
@@ -88,6 +107,7 @@ namespace zutty
       uint16_t ny = 0; // number of rows in atlas texture
       std::vector <uint8_t> atlasBuf; // loaded atlas data
       AtlasMap atlasMap; // unicode -> atlas position
+      std::string cacheKey; // identifies the atlas in the on-disk cache
 
       /* Start with 1 so as to leave a blank glyph at (0,0).
        * That blank will get referenced for any out-of-bounds text position
@@ -103,12 +123,24 @@ namespace zutty
       /* Load font from glyph bitmaps rasterized by FreeType.
        * Store the bitmaps into an atlas bitmap stored in atlasBuf.
        */
-      bool isLoadableChar (FT_ULong c);
+      bool isLoadableChar (FT_ULong c) const;
+      bool isPreloadedChar (FT_ULong c);
       void load ();
       void loadFixed (const FT_Face& face, int pixelSize);
       void loadScaled (const FT_Face& face, int pixelSize);
       void loadFace (const FT_Face& face, FT_ULong c);
       void loadFace (const FT_Face& face, FT_ULong c, const AtlasPos& apos);
+
+      /* The loaded atlas is saved to a cache file, and loaded from there
+       * on subsequent starts instead of rasterizing the glyphs again. The
+       * key covers everything the atlas contents depend on, including
+       * the key of the primary font for overlay and double-width fonts.
+       */
+      std::string makeCacheKey (const std::string& filename,
+                                int pixelSize, int lcdFilter) const;
+      bool loadCache (const std::string& path);
+      bool readCache (const uint8_t* data, size_t size);
+      void saveCache (const std::string& path) const;
    };
 
 } // namespace zutty
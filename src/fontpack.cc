@@ -19,6 +19,9 @@
 #include <strings.h>
 #include <fontconfig/fontconfig.h>
 
+#include <future>
+#include <thread>
+
 namespace
 {
 
@@ -38,6 +41,13 @@ FcPattern *matchFont(FcConfig *config, FcPattern *pattern)
 
 namespace zutty
 {
+   std::launch
+   Fontpack::getLaunchPolicy ()
+   {
+      return std::thread::hardware_concurrency () > 1
+         ? std::launch::async : std::launch::deferred;
+   }
+
    Fontpack::Fontpack (const std::string& fontname,
                        const std::string& dwfontname)
    {
@@ -80,12 +90,29 @@ namespace zutty
       px = fontRegular->getPx ();
       py = fontRegular->getPy ();
 
+      // The other fonts only depend on the geometry and atlas map of the
+      // regular one, and each has a FreeType library instance of its own,
+      // so they are loaded in parallel (see getLaunchPolicy). Any
+      // exception thrown while loading one is passed on by get () below.
+      using FontFuture = std::future <std::unique_ptr <Font>>;
+      const auto policy = getLaunchPolicy ();
+      auto loadAsync = [this, policy] (FcPattern* m, auto kind) -> FontFuture
+      {
+         return std::async (policy,
+                            [this, m, kind] ()
+                            {
+                               return std::make_unique<Font>(m, *fontRegular,
+                                                             kind);
+                            });
+      };
+      FontFuture italic, boldItalic, bold, doubleWidth;
+
       FcPatternDel(pattern, FC_SLANT);
       FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ITALIC);
       match = matchFont(config, pattern);
       if (match)
       {
-         fontItalic = std::make_unique<Font>(match, *fontRegular, Font::Overlay);
+         italic = loadAsync (match, Font::Overlay);
       }
       else
       {
@@ -97,7 +124,7 @@ namespace zutty
       match = matchFont(config, pattern);
       if (match)
       {
-         fontBoldItalic = std::make_unique<Font>(match, *fontRegular, Font::Overlay);
+         boldItalic = loadAsync (match, Font::Overlay);
       }
       else
       {
@@ -109,7 +136,7 @@ namespace zutty
       match = matchFont(config, pattern);
       if (match)
       {
-         fontBold = std::make_unique<Font>(match, *fontRegular, Font::Overlay);
+         bold = loadAsync (match, Font::Overlay);
       }
       else
       {
@@ -125,19 +152,55 @@ namespace zutty
          {
             logW << "cannot parse double-width font reference '" << dwfontname << "'"
                << std::endl;
-            return;
-         }
-         match = matchFont(config, pattern);
-         if (match)
-         {
-            fontDoubleWidth = std::make_unique<Font>(match, *fontRegular, Font::DoubleWidth);
          }
          else
          {
-            logW << "Failed to load double-width font '" << dwfontname << "'" << std::endl;
+            match = matchFont(config, pattern);
+            if (match)
+            {
+               doubleWidth = loadAsync (match, Font::DoubleWidth);
+            }
+            else
+            {
+               logW << "Failed to load double-width font '" << dwfontname << "'" << std::endl;
+            }
+            FcPatternDestroy(pattern);
          }
-         FcPatternDestroy(pattern);
       }
+
+      if (italic.valid ())
+         fontItalic = italic.get ();
+      if (boldItalic.valid ())
+         fontBoldItalic = boldItalic.get ();
+      if (bold.valid ())
+         fontBold = bold.get ();
+      if (doubleWidth.valid ())
+         fontDoubleWidth = doubleWidth.get ();
+   }
+
+   void
+   Fontpack::loadGlyph (uint16_t c, const Font::AtlasPos& apos, bool dwidth)
+   {
+      if (dwidth)
+      {
+         fontDoubleWidth->loadGlyph (c, apos, nullptr);
+         return;
+      }
+
+      fontRegular->loadGlyph (c, apos, nullptr);
+      for (Font* variant: {fontBold.get (), fontItalic.get (),
+                           fontBoldItalic.get ()})
+         if (variant)
+            variant->loadGlyph (c, apos, fontRegular.get ());
+   }
+
+   void
+   Fontpack::unloadGlyph (uint16_t c, bool dwidth)
+   {
+      for (Font* fnt: {fontRegular.get (), fontBold.get (), fontItalic.get (),
+                       fontBoldItalic.get (), fontDoubleWidth.get ()})
+         if (fnt && (fnt == fontDoubleWidth.get ()) == dwidth)
+            fnt->unloadGlyph (c);
    }
 
 } // namespace zutty
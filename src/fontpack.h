@@ -14,6 +14,7 @@
 #include "font.h"
 
 #include <cstdint>
+#include <future>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -35,6 +36,11 @@ namespace zutty
 
       ~Fontpack () = default;
 
+      // How to run font loading in the background: on a thread of its
+      // own, unless there is a single CPU to run it, where that only adds
+      // overhead (and loading is deferred to when the result is needed).
+      static std::launch getLaunchPolicy ();
+
       uint16_t getPx () const { return px; };
       uint16_t getPy () const { return py; };
 
@@ -74,6 +80,12 @@ namespace zutty
          return * fontDoubleWidth.get ();
       };
 
+      /* Load the glyph of c into all fonts into an atlas position, or (if
+       * dwidth) into the double-width font, for fonts loaded lazily.
+       */
+      void loadGlyph (uint16_t c, const Font::AtlasPos& apos, bool dwidth);
+      void unloadGlyph (uint16_t c, bool dwidth);
+
       void releaseFonts ()
       {
          fontRegular = nullptr;
@@ -12,8 +12,66 @@
 #include "frame.h"
 #include "log.h"
 
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+   using Cell = zutty::CharVdev::Cell;
+
+   // Whether a cell is the same as a freshly erased one (with defaults)
+   bool
+   isBlankCell (const Cell& cell)
+   {
+      return cell.uc_pt == ' ' && !cell.dwidth && !cell.dwidth_cont &&
+         !cell.bold && !cell.italic && !cell.underline && !cell.inverse &&
+         !cell.wrap && cell.fg == zutty::Default_Fg_Code &&
+         cell.bg == zutty::Default_Bg_Code;
+   }
+
+   /* The column where a match of query (folded) starts in row, at or
+    * before x if older, at or after x else; -1 if none. The end of the
+    * match (exclusive) is returned in end.
+    */
+   int
+   findInRow (const Cell* row, int nCols, const std::vector <uint16_t>& query,
+              int x, bool older, int& end)
+   {
+      using zutty::Scrollback;
+      const int step = older ? -1 : 1;
+      for (int s = older ? std::min (x, nCols - 1) : std::max (x, 0);
+           s >= 0 && s < nCols; s += step)
+      {
+         if (row [s].dwidth_cont)
+            continue;
+
+         int i = s;
+         size_t j = 0;
+         for (; j < query.size () && i < nCols; ++i)
+         {
+            if (row [i].dwidth_cont)
+               continue;
+            if (Scrollback::foldCase (row [i].uc_pt) != query [j])
+               break;
+            ++j;
+         }
+         if (j == query.size ())
+         {
+            while (i < nCols && row [i].dwidth_cont)
+               ++i;
+            end = i;
+            return s;
+         }
+      }
+      return -1;
+   }
+
+} // namespace
+
 namespace zutty
 {
+   constexpr const uint16_t Frame::maxRingSaveLines;
+
    Frame::Frame () {}
 
    Frame::Frame (uint16_t winPx_, uint16_t winPy_,
@@ -27,26 +85,48 @@ namespace zutty
       , saveLines (saveLines_)
       , scrollHead (0)
       , marginTop (0)
-      , marginBottom (nRows + saveLines)
+      , marginBottom (nRows + std::min (saveLines, maxRingSaveLines))
       , historyRows (0)
       , viewOffset (0)
       , margins (false)
-      , cells (CharVdev::make_cells (nCols, nRows + saveLines))
+      , ringSaveLines (std::min (saveLines, maxRingSaveLines))
+      , cells ((size_t) nCols * (nRows + ringSaveLines))
+      , rowMap (nRows + ringSaveLines)
+      , history (saveLines - ringSaveLines)
    {
+      std::iota (rowMap.begin (), rowMap.end (), 0);
       marginTop_ = marginTop;
       marginBottom_ = nRows;
-      damage.totalCells = nCols * (nRows + saveLines);
-      highMemUsageReport ();
+      damage.resize (nCols, nRows + ringSaveLines);
    }
 
    void
    Frame::dropScrollbackHistory ()
    {
+      if (!offered.null () && offered.tl.y < 0)
+         saveSelectionText ();
       viewOffset = 0;
       historyRows = 0;
+      history.clear ();
       expose ();
    }
 
+   void
+   Frame::markColors (std::vector <bool>& used) const
+   {
+      if (cells)
+      {
+         const CharVdev::Cell* const end =
+            cells.get () + (size_t) nCols * (nRows + ringSaveLines);
+         for (const CharVdev::Cell* cell = cells.get (); cell < end; ++cell)
+         {
+            used [cell->fg] = true;
+            used [cell->bg] = true;
+         }
+      }
+      history.markColors (used);
+   }
+
    void
    Frame::setMargins (uint16_t marginTop_, uint16_t marginBottom_)
    {
@@ -62,7 +142,7 @@ namespace zutty
    {
       unwrapCellStorage ();
       scrollHead = marginTop = marginTop_ = 0;
-      marginBottom = nRows + saveLines;
+      marginBottom = nRows + ringSaveLines;
       marginBottom_ = nRows;
       margins = false;
       expose ();
@@ -71,7 +151,8 @@ namespace zutty
    void
    Frame::resize (uint16_t winPx_, uint16_t winPy_,
                   uint16_t nCols_, uint16_t nRows_,
-                  uint16_t& marginTop_, uint16_t& marginBottom_)
+                  uint16_t& marginTop_, uint16_t& marginBottom_,
+                  uint16_t& cursorY, uint16_t& cursorX, bool& lastCol)
    {
       if (winPx == winPx_ && winPy == winPy_)
          return;
@@ -82,57 +163,135 @@ namespace zutty
       if (nCols == nCols_ && nRows == nRows_)
          return;
 
-      auto newCells = CharVdev::make_cells (nCols_, nRows_ + saveLines);
-      CharVdev::Cell* dst = newCells.get ();
+      saveSelectionText ();
+
+      // Lay out the rows in cells (history, then the screen) at the new
+      // width, each logical line starting on a row of its own
+      std::vector <CharVdev::Cell> out;
+      out.reserve ((getRingHistoryRows () + nRows) * nCols_);
+      int outRows = 0;
+      uint16_t outX = nCols_;
+      auto newRow =
+         [&] ()
+         {
+            out.resize (out.size () + nCols_);
+            ++outRows;
+            outX = 0;
+         };
 
-      const int rowLen = std::min (nCols, nCols_);
-      const int nCopyRows = std::min (nRows, nRows_);
-      CharVdev::Cell* p = dst;
-      for (int pY = 0; pY < nCopyRows; ++pY)
+      int screenTop = 0;
+      int cursorRow = -1;
+      uint16_t cursorCol = 0;
+      bool cont = false; // does the previous row continue in this one?
+      for (int pY = -getRingHistoryRows (); pY < nRows; ++pY)
       {
-         memcpy (p, getPhysRowPtr (pY), rowLen * cellSize);
-         p += nCols_;
+         if (!cont)
+            newRow ();
+         if (pY == 0)
+            screenTop = outRows - 1;
+
+         const CharVdev::Cell* src = getPhysRowPtr (pY);
+         const bool wraps = src [nCols - 1].wrap;
+         uint16_t len = nCols;
+         uint16_t textLen = nCols;
+         if (!wraps)
+         {
+            while (len && isBlankCell (src [len - 1]))
+               --len;
+            textLen = len;
+            if (pY == cursorY)
+               len = std::max (len, (uint16_t) std::min (cursorX + 1,
+                                                         (int) nCols));
+         }
+
+         for (uint16_t x = 0; x < len; ++x)
+         {
+            const CharVdev::Cell& cell = src [x];
+            if (pY == cursorY && x == cursorX && x >= textLen && outX == nCols_)
+            {
+               // Right after the end of the text: a pending wrap
+               cursorRow = outRows - 1;
+               cursorCol = nCols_ - 1;
+               lastCol = true;
+               break;
+            }
+            if (outX == nCols_ ||
+                (cell.dwidth && outX == nCols_ - 1 && nCols_ > 1))
+            {
+               out [outRows * nCols_ - 1].wrap = 1;
+               newRow ();
+            }
+            if (pY == cursorY && x == cursorX)
+            {
+               cursorRow = outRows - 1;
+               cursorCol = outX;
+            }
+            CharVdev::Cell& dst = out [(outRows - 1) * nCols_ + outX++];
+            dst = cell;
+            if (wraps && x == nCols - 1)
+               dst.wrap = 0;
+         }
+         cont = wraps;
       }
-      p = dst + (nRows_ + saveLines - historyRows) * nCols_;
-      for (int pY = -historyRows; pY < 0; ++pY)
+
+      // Place the cursor after the last character if a wrap is pending
+      if (cursorRow < 0)
       {
-         memcpy (p, getPhysRowPtr (pY), rowLen * cellSize);
-         p += nCols_;
+         cursorRow = outRows - 1;
+         cursorCol = 0;
       }
+      else if (lastCol && cursorCol < nCols_ - 1)
+      {
+         ++cursorCol;
+         lastCol = false;
+      }
+
+      // Keep the rows at the top of the screen in place if possible; fill
+      // up the screen from history if lines got shorter, or push rows to
+      // history if needed to keep the cursor visible
+      int top = screenTop;
+      if (outRows - top < nRows_)
+         top = std::max (0, outRows - nRows_);
+      if (cursorRow >= top + nRows_)
+         top = std::min (outRows - nRows_, cursorRow);
+
+      CellBuffer newCells ((size_t) nCols_ * (nRows_ + ringSaveLines));
+      CharVdev::Cell* dst = newCells.get ();
+      const int nScreen = std::min ((int) nRows_, outRows - top);
+      memcpy (dst, out.data () + top * nCols_, nScreen * nCols_ * cellSize);
+
+      const int nRing = std::min ((int) ringSaveLines, top);
+      memcpy (dst + (nRows_ + ringSaveLines - nRing) * nCols_,
+              out.data () + (top - nRing) * nCols_,
+              nRing * nCols_ * cellSize);
+
+      // Rows beyond the ring go to packed history; conversely, the ring
+      // is refilled from there if lines got shorter
+      for (int k = 0; k < top - nRing; ++k)
+         history.push (out.data () + k * nCols_, nCols_);
+      int nFilled = nRing;
+      for (; nFilled < ringSaveLines && history.size (); ++nFilled)
+         history.pop (dst + (nRows_ + ringSaveLines - nFilled - 1) * nCols_,
+                      nCols_);
 
       cells = std::move (newCells);
+      rowMap.resize (nRows_ + ringSaveLines);
+      std::iota (rowMap.begin (), rowMap.end (), 0);
+      if (nCols != nCols_)
+         selection.clear ();
       nCols = nCols_;
       nRows = nRows_;
       scrollHead = 0;
       marginTop = marginTop_ = 0;
       marginBottom_ = nRows;
-      marginBottom = nRows + saveLines;
+      marginBottom = nRows + ringSaveLines;
       margins = false;
+      historyRows = nFilled + history.size ();
       viewOffset = 0;
-      damage.totalCells = nCols * (nRows + saveLines);
-      highMemUsageReport ();
-   }
+      damage.resize (nCols, nRows + ringSaveLines);
 
-   void
-   Frame::fullCopyCells (CharVdev::Cell * const dst)
-   {
-      CharVdev::Cell* p = dst;
-      for (int pY = 0; pY < nRows; ++pY)
-      {
-         memcpy (p, getViewRowPtr (pY), nCols * cellSize);
-         p += nCols;
-      }
-   }
-
-   void
-   Frame::deltaCopyCells (CharVdev::Cell * const dst)
-   {
-      CharVdev::Cell* p = dst;
-      for (int pY = -viewOffset; pY < nRows - viewOffset; ++pY)
-      {
-         damageDeltaCopy (p, nCols * getPhysicalRow (pY), nCols);
-         p += nCols;
-      }
+      cursorY = cursorRow - top;
+      cursorX = cursorCol;
    }
 
    Rect
@@ -175,139 +334,195 @@ namespace zutty
       return ret;
    }
 
-   bool
-   Frame::getSelectedUtf8 (std::string& utf8_selection) const
+   Frame::SelectionReader
+   Frame::readSelection ()
    {
-      const Rect sel = getSnappedSelection ();
-
+      SelectionReader reader;
+      Rect sel = getSnappedSelection ();
       if (sel.empty ())
-         return false;
-
-      using utf16str = std::vector <uint16_t>;
-      std::vector <utf16str> lines;
-      bool wrap = false;
+         return reader;
+
+      // N.B.: the selection is in view coordinates
+      sel.tl.y -= viewOffset;
+      sel.br.y -= viewOffset;
+      offered = sel;
+      reader.text = std::make_shared <SelectionReader::Text> ();
+      reader.text->frame = this;
+      offeredText = reader.text;
+      return reader;
+   }
 
-      // save lines from the selected range of the frame cell buffer
-      auto addLine =
-         [&] (int y, uint16_t x1, uint16_t x2)
-         {
-            utf16str line;
-            bool wrapBack = wrap;
-            wrap = false;
-            const auto* cp = getViewRowPtr (y);
-            for (uint16_t x = x1; x < x2; ++x)
-            {
-               const auto& cell = cp [x];
-               if (!cell.dwidth_cont)
-                  line.push_back (cell.uc_pt);
-               if (cell.wrap)
-               {
-                  wrap = true;
-                  break;
-               }
-            }
+   void
+   Frame::saveSelectionText ()
+   {
+      auto text = offeredText.lock ();
+      if (text)
+      {
+         SelectionReader reader;
+         reader.text = text;
+         reader.read (text->saved, std::string::npos);
+         text->frame = nullptr;
 
-            while (!wrap && line.size () && line.back () == ' ')
-               line.pop_back (); // discard trailing whitespace
+         logT << "Saved " << text->saved.size ()
+              << " bytes of selected text" << std::endl;
+      }
+      offered.clear ();
+      offeredText.reset ();
+   }
 
-            if (wrapBack && lines.size ())
-               lines.back ().insert (lines.back ().end (),
-                                     line.begin (), line.end ());
-            else
-               lines.push_back (line);
-         };
+   bool
+   Frame::SelectionReader::read (std::string& buf, size_t maxLen)
+   {
+      if (!text)
+         return false;
 
-      if (sel.tl.y == sel.br.y)
-      {
-         addLine (sel.tl.y, sel.tl.x, sel.br.x);
-      }
-      else if (sel.rectangular)
-      {
-         for (int y = sel.tl.y; y <= sel.br.y; ++y)
-            addLine (y, sel.tl.x, sel.br.x);
-      }
-      else
+      const size_t start = buf.size ();
+      if (!text->frame)
       {
-         addLine (sel.tl.y, sel.tl.x, nCols);
-         for (int y = sel.tl.y + 1; y < sel.br.y; ++y)
-            addLine (y, 0, nCols);
-         addLine (sel.br.y, 0, sel.br.x);
+         const size_t len = std::min (maxLen, text->saved.size () - pos);
+         buf.append (text->saved, pos, len);
+         pos += len;
+         return pos < text->saved.size ();
       }
 
-      // convert to UTF-8
-      std::vector <char> utf8_out;
-      auto sinkFn = [&] (char ch) { utf8_out.push_back (ch); };
-      for (const auto& u16s: lines)
+      const Frame& fr = *text->frame;
+      if (fr.offeredText.lock () != text)
+         return false; // no longer offered (and not saved)
+
+      const Rect& sel = fr.offered;
+      const int nLines = sel.br.y - sel.tl.y + 1;
+      auto sinkFn = [&] (char ch) { buf.push_back (ch); };
+      for (; line < nLines; ++line, x = 0)
       {
-         for (uint16_t cp: u16s)
-            Utf8Encoder::pushUnicode (cp, sinkFn);
-         utf8_out.push_back ('\n');
+         const bool first = line == 0;
+         const bool last = line == nLines - 1;
+         const uint16_t x1 = first || sel.rectangular ? sel.tl.x : 0;
+         const uint16_t x2 = last || sel.rectangular ? sel.br.x : fr.nCols;
+         const auto* cp = fr.getPhysRowPtr (sel.tl.y + line);
+
+         // The text of a row ends with a wrapped cell (to be continued
+         // on the next row), or else before any trailing whitespace
+         uint16_t end = x1;
+         while (end < x2 && !cp [end].wrap)
+            ++end;
+         const bool wrap = end < x2;
+         if (wrap)
+            ++end;
+         else
+            while (end > x1 &&
+                   (cp [end - 1].dwidth_cont || cp [end - 1].uc_pt == ' '))
+               --end;
+
+         for (x = std::max (x, x1); x < end; ++x)
+         {
+            if (cp [x].dwidth_cont)
+               continue;
+
+            // N.B.: trailing line breaks are never written
+            while (newlines && buf.size () - start < maxLen)
+            {
+               buf.push_back ('\n');
+               --newlines;
+            }
+            if (newlines || buf.size () - start + 4 > maxLen)
+            {
+               pos += buf.size () - start;
+               return true;
+            }
+            Utf8Encoder::pushUnicode (resolveCode (cp [x].uc_pt), sinkFn);
+         }
+         if (!wrap)
+            ++newlines;
       }
-      while (utf8_out.size () && utf8_out.back () == '\n')
-         utf8_out.pop_back (); // discard trailing empty lines
-
-      utf8_selection = std::string (utf8_out.data (), utf8_out.size ());
-
-   #if DEBUG
-      if (utf8_selection.size () <= 80)
-         logT << "Selected " << utf8_selection.size () << " bytes:\n'"
-              << utf8_selection << "'" << std::endl;
-      else
-         logT << "Selected " << utf8_selection.size () << " bytes:\n'"
-              << utf8_selection.substr (0, 40) << "' ...\n'"
-              << utf8_selection.substr (utf8_selection.size () - 40) << "'"
-              << std::endl;
-   #endif // DEBUG
-      return true;
+      pos += buf.size () - start;
+      return false;
    }
 
-   // private functions
-
-   inline void
-   Frame::damageDeltaCopy (CharVdev::Cell* dst, uint32_t start, uint32_t count)
+   bool
+   Frame::search (const std::vector <uint16_t>& query,
+                  bool older, bool skipCurrent)
    {
-      uint32_t end = start + count;
-
-      if (damage.end <= start || end <= damage.start)
-         return; // no intersection
+      if (query.empty ())
+         return false;
 
-      if (start < damage.start)
+      std::vector <uint16_t> q;
+      for (uint16_t code: query)
+         q.push_back (Scrollback::foldCase (code));
+      std::vector <uint32_t> trigrams;
+      for (size_t k = 2; k < q.size (); ++k)
+         trigrams.push_back (Scrollback::getTrigram (q [k - 2], q [k - 1],
+                                                     q [k]));
+
+      int y = older ? nRows - 1 : -historyRows;
+      int x = older ? nCols - 1 : 0;
+      if (!selection.null ())
       {
-         dst += (damage.start - start);
-         start = damage.start;
+         y = selection.tl.y - viewOffset;
+         x = selection.tl.x + (skipCurrent ? (older ? -1 : 1) : 0);
       }
 
-      if (damage.end < end)
+      const int step = older ? -1 : 1;
+      for (; y >= -historyRows && y < nRows; y += step)
       {
-         end = damage.end;
-      }
-
-      CharVdev::Cell* const src = cells.get ();
+         // Skip blocks of packed history rows that cannot match
+         if (y < -ringSaveLines)
+         {
+            const int n = history.skipRows (-y - ringSaveLines, trigrams,
+                                            older);
+            if (n)
+            {
+               y += step * (n - 1);
+               x = older ? nCols - 1 : 0;
+               continue;
+            }
+         }
 
-      for (size_t i = 0, j = start; j < end; ++i, ++j)
-      {
-         if (dst [i] != src [j])
+         int end;
+         const int found = findInRow (getPhysRowPtr (y), nCols, q, x,
+                                      older, end);
+         if (found >= 0)
          {
-            dst [i] = src [j];
-            dst [i].dirty = 1;
+            // Scroll the view for the match to be in the middle, if needed
+            if (y < -viewOffset || y >= nRows - viewOffset)
+            {
+               int offset = std::max (0, std::min ((int) historyRows,
+                                                   nRows / 2 - y));
+               if (offset > viewOffset)
+                  pageUp (offset - viewOffset);
+               else
+                  pageDown (viewOffset - offset);
+            }
+            selection = Rect (found, y + viewOffset, end, y + viewOffset);
+            snapTo = SelectSnapTo::Char;
+            return true;
          }
+         x = older ? nCols - 1 : 0;
       }
+      return false;
    }
 
+   // private functions
+
    void
-   Frame::copyAllCells (CharVdev::Cell * const dst)
+   Frame::rotateRows (uint16_t startY, uint16_t endY, int count)
    {
-      CharVdev::Cell* p = dst;
-      for (int pY = 0; pY < nRows; ++pY)
-      {
-         memcpy (p, getPhysRowPtr (pY), nCols * cellSize);
-         p += nCols;
-      }
-      p = dst + (nRows + saveLines - historyRows) * nCols;
-      for (int pY = -historyRows; pY < 0; ++pY)
+      const int n = endY - startY;
+      count %= n;
+      if (count < 0)
+         count += n;
+      if (!count)
+         return;
+
+      invalidateSelection (Rect (0, startY, 0, endY));
+      rotated.clear ();
+      for (uint16_t pY = startY; pY < endY; ++pY)
+         rotated.push_back (getPhysicalRow (pY));
+      std::rotate (rotated.begin (), rotated.begin () + count, rotated.end ());
+      for (uint16_t pY = startY; pY < endY; ++pY)
       {
-         memcpy (p, getPhysRowPtr (pY), nCols * cellSize);
-         p += nCols;
+         const uint16_t row = rotated [pY - startY];
+         rowMap [getSlot (pY)] = row;
+         damage.addRow (row, 0, nCols);
       }
    }
 
@@ -317,23 +532,14 @@ namespace zutty
       if (scrollHead == marginTop)
          return;
 
-      auto newCells = CharVdev::make_cells (nCols, nRows + saveLines);
-      copyAllCells (newCells.get ());
-      cells = std::move (newCells);
+      // Straighten out the slots of the (screen, then history) rows; the
+      // cells themselves stay in place
+      const int nSlots = nRows + ringSaveLines;
+      rotated.resize (nSlots);
+      for (int pY = nRows - nSlots; pY < nRows; ++pY)
+         rotated [pY < 0 ? pY + nSlots : pY] = getPhysicalRow (pY);
+      rowMap.swap (rotated);
       scrollHead = marginTop;
    }
 
-   void
-   Frame::highMemUsageReport ()
-   {
-      auto allocKB = damage.totalCells * cellSize / 1024;
-      if (allocKB > 8192)
-      {
-         logI << "Allocated " << allocKB << " KiB for cell storage; consider "
-              << "decreasing saveLines (current value: " << saveLines
-              << ") to reduce memory usage!"
-              << std::endl;
-      }
-   }
-
 } // namespace zutty
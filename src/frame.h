@@ -11,9 +11,15 @@
 
 #pragma once
 
+#include "cellbuf.h"
 #include "charvdev.h"
+#include "scrollback.h"
 #include "utf8.h"
 
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace zutty
 {
    class Frame
@@ -26,26 +32,52 @@ namespace zutty
              uint16_t& marginTop_, uint16_t& marginBottom_,
              uint16_t saveLines_ = 0);
 
+      /* Rows wrapped at the end of a line are rejoined and laid out
+       * anew at the new width, with the cursor position (row and column
+       * in screen coordinates, lastCol with a pending wrap) following
+       * its place in the text. History rows older than those kept in
+       * cells are left as they are, at the width they were stored with.
+       */
       void resize (uint16_t winPx_, uint16_t winPy_,
                    uint16_t nCols_, uint16_t nRows_,
-                   uint16_t& marginTop_, uint16_t& marginBottom_);
+                   uint16_t& marginTop_, uint16_t& marginBottom_,
+                   uint16_t& cursorY, uint16_t& cursorX, bool& lastCol);
 
       void dropScrollbackHistory ();
       void setMargins (uint16_t marginTop_, uint16_t marginBottom_);
       void resetMargins (uint16_t& marginTop_, uint16_t& marginBottom_);
 
       void fillCells (uint16_t ch, const CharVdev::Cell& attrs);
-      void fullCopyCells (CharVdev::Cell * const dest);
-      void deltaCopyCells (CharVdev::Cell * const dest);
 
-      operator bool () const { return cells != nullptr; }
-      void freeCells () { cells = nullptr; }
+      // Mark the color codes used by cells and history (see setColorSweep)
+      void markColors (std::vector <bool>& used) const;
+
+      // Access to the visible rows, for taking snapshots (see Renderer)
+      bool getViewRowDamage (uint16_t pY,
+                             uint16_t& startX, uint16_t& endX) const;
+      void copyViewRow (uint16_t pY, CharVdev::Cell * const dest) const;
+
+      operator bool () const { return (bool) cells; }
+      void freeCells () { saveSelectionText (); cells.reset (); }
 
       const CharVdev::Cell & getCell (uint16_t pY, uint16_t pX) const;
       CharVdev::Cell & getCell (uint16_t pY, uint16_t pX);
 
+      /* Mutators below only mark cells damaged if what they write differs
+       * from what is there, so that programs rewriting the screen with
+       * the same content (watch, status lines, etc.) cause no redraws.
+       * getCell () above is the exception: it marks the cell damaged
+       * before anything is written to it, so it is best left for cells
+       * known to change.
+       */
+      const CharVdev::Cell & peekCell (uint16_t pY, uint16_t pX) const;
+      void setCell (uint16_t pY, uint16_t pX, const CharVdev::Cell& cell);
+
       void eraseInRow (uint16_t pY, uint16_t startX, uint16_t count,
                        const CharVdev::Cell& attrs);
+      void writeInRow (uint16_t pY, uint16_t startX,
+                       const unsigned char* text, uint16_t count,
+                       const CharVdev::Cell& attrs);
       void moveInRow (uint16_t pY, uint16_t dstX, uint16_t srcX,
                       uint16_t count);
       void copyRow (uint16_t dstY, uint16_t srcY, uint16_t startX,
@@ -54,6 +86,11 @@ namespace zutty
       void scrollUp (uint16_t count);
       void scrollDown (uint16_t count);
 
+      // Move the rows of the screen in [startY, endY) up by count rows
+      // (down if negative), with the rows shifted out coming back in at
+      // the other end, to be erased by the caller.
+      void rotateRows (uint16_t startY, uint16_t endY, int count);
+
       void pageUp (uint16_t count);
       void pageDown (uint16_t count);
       void pageToBottom ();
@@ -76,11 +113,50 @@ namespace zutty
       Rect& getSelection () { return selection; };
       const Rect& getSelection () const { return selection; };
       Rect getSnappedSelection () const;
-      bool getSelectedUtf8 (std::string& utf8_selection) const;
 
-      constexpr const static size_t cellSize = sizeof (CharVdev::Cell);
+      /* Reader of the selected text (as UTF-8), producing it in chunks
+       * on demand, as selected when the reader was made (see below).
+       * The text is read from the rows of the frame while these stay in
+       * place; before they get overwritten or dropped, the text is saved
+       * for the readers still around. Copies of a reader read on
+       * independently of each other.
+       */
+      class SelectionReader
+      {
+      public:
+         // Append at most maxLen bytes to buf; return false at the end
+         bool read (std::string& buf, size_t maxLen);
+         explicit operator bool () const { return text != nullptr; }
+
+      private:
+         friend class Frame;
+         struct Text
+         {
+            const Frame* frame = nullptr; // rows read, or null once saved
+            std::string saved;
+         };
+         std::shared_ptr <Text> text;
+         size_t pos = 0;        // bytes read so far
+         int line = 0;          // row of the selection being read
+         uint16_t x = 0;        // next column to read in that row
+         uint32_t newlines = 0; // line breaks not yet written
+      };
+
+      // Offer the current selection for reading. Any text offered
+      // before is no longer readable (unless it was saved already).
+      SelectionReader readSelection ();
 
-      uint64_t seqNo = 0; // update counter (used by Renderer)
+      /* Search history and screen for the text of query (codes as in
+       * cells), going upwards (older) or downwards from the current
+       * match (the selection), or else the bottom (top) of the frame.
+       * The current match itself will only be found unless skipCurrent.
+       * A match found is selected, with the view scrolled to show it.
+       * Matches do not continue onto following (wrapped) rows.
+       */
+      bool search (const std::vector <uint16_t>& query,
+                   bool older, bool skipCurrent);
+
+      constexpr const static size_t cellSize = sizeof (CharVdev::Cell);
 
       uint16_t winPx = 0;
       uint16_t winPy = 0;
@@ -88,6 +164,9 @@ namespace zutty
       uint16_t nRows = 0;
       uint16_t saveLines = 0;
 
+      // Most recent history rows kept as cells; older ones are packed
+      constexpr const static uint16_t maxRingSaveLines = 1024;
+
    private:
       uint16_t scrollHead;   // row offset of scrolling area's logical top row
       uint16_t marginTop;    // current margin top (number of rows above)
@@ -95,25 +174,42 @@ namespace zutty
       uint16_t historyRows;  // number of history (off-screen) rows with data
       uint16_t viewOffset;   // how many rows above top row does the view start?
       bool margins = false;  // are there (non-default) top/bottom margins set?
+      uint16_t ringSaveLines = 0; // history rows kept unpacked in cells
 
-      CharVdev::Cell::Ptr cells = nullptr;
+      CellBuffer cells;
+      std::vector <uint16_t> rowMap; // physical row in cells of each slot
+      std::vector <uint16_t> rotated; // scratch space for rowMap updates
+      Scrollback history; // history rows older than those in cells
       CharVdev::Cursor cursor;
       Rect selection;
       SelectSnapTo snapTo = SelectSnapTo::Char;
+      Rect offered; // text offered to readers, in screen coordinates
+      std::weak_ptr <SelectionReader::Text> offeredText;
 
       struct Damage
       {
-         uint32_t start = 0;
-         uint32_t end = 0;
-         uint32_t totalCells = 0;
-
+         struct Span
+         {
+            uint16_t start = 0; // first damaged column
+            uint16_t end = 0;   // last damaged column + 1 (none if == start)
+         };
+         std::vector <Span> rows;          // per physical row of storage
+         std::vector <uint32_t> dirtyRows; // rows with a non-empty span
+         uint16_t nCols = 0;
+         bool all = false;                 // everything is damaged
+
+         void resize (uint16_t nCols_, uint32_t nRows_);
          void reset ();
          void expose ();
          void add (uint32_t start_, uint32_t end_);
+         void addRow (uint32_t row, uint16_t startX, uint16_t endX);
       };
       Damage damage;
 
+      uint16_t getRingHistoryRows () const;
+      int getSlot (int pY) const;
       int getPhysicalRow (int pY) const;
+      void damageSlots (uint16_t first, uint16_t last);
       const CharVdev::Cell * getPhysRowPtr (int pY) const;
       const CharVdev::Cell * getViewRowPtr (int pY) const;
       uint32_t getIdx (uint16_t pY, uint16_t pX) const;
@@ -125,8 +221,6 @@ namespace zutty
       void copyCells (uint32_t dstIx, uint32_t srcIx, uint32_t count);
       void moveCells (uint32_t dstIx, uint32_t srcIx, uint32_t count);
 
-      void damageDeltaCopy (CharVdev::Cell* dst, uint32_t start, uint32_t count);
-      void copyAllCells (CharVdev::Cell * const dest);
       void unwrapCellStorage ();
 
       static SelectSnapTo cycleSelectSnapTo (SelectSnapTo& snapTo)
@@ -138,8 +232,7 @@ namespace zutty
 
       void vscrollSelection (int vertOffset);
       void invalidateSelection (const Rect&& damage);
-
-      void highMemUsageReport ();
+      void saveSelectionText ();
    };
 
 } // namespace zutty
@@ -17,14 +17,20 @@
 
 #include "base.h"
 #include "base64.h"
+#include "daemon.h"
 #include "fontpack.h"
 #include "options.h"
 #include "pty.h"
+#include "record.h"
 #include "renderer.h"
 #include "selmgr.h"
+#include "stats.h"
 #include "vterm.h"
 
 #include <cassert>
+#include <clocale>
+#include <fstream>
+#include <future>
 #include <langinfo.h>
 #include <memory>
 #include <poll.h>
@@ -36,6 +42,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 using zutty::Fontpack;
 using zutty::MouseTrackingState;
@@ -56,6 +63,12 @@ static Window xWindow;
 static Atom wmDeleteMessage;
 static XSizeHints sizeHints;
 static Colormap colormap;
+static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC eglSwapBuffersWithDamage = nullptr;
+
+// Incremental search, with its prompt shown in place of the window title
+static bool searchMode = false;
+static std::string searchQuery;
+static std::string windowTitle;
 
 static void
 convertColor (const zutty::Color& color, XColor& xcolor)
@@ -160,7 +173,7 @@ makeXWindow (const char* name, int width, int height, int px, int py,
    attr.colormap = colormap;
    attr.event_mask = StructureNotifyMask | ExposureMask | FocusChangeMask |
       PropertyChangeMask | KeyPressMask | ButtonPressMask | ButtonReleaseMask |
-      PointerMotionMask;
+      PointerMotionMask | VisibilityChangeMask;
    mask = CWBackPixel | CWBorderPixel | CWColormap | CWEventMask;
 
    xWindow = XCreateWindow (xDisplay, root, 0, 0, width, height,
@@ -441,6 +454,83 @@ pasteCb (bool success, const std::string& content)
       vt->pasteSelection (content);
 }
 
+static void
+setPrimarySelection (zutty::Frame::SelectionReader&& reader, Time time)
+{
+   if (! reader)
+      return;
+
+   selMgr->setSelection (selMgr->getPrimary (), time,
+                         [reader] (std::string& buf, size_t maxLen) mutable
+                         {
+                            return reader.read (buf, maxLen);
+                         });
+   if (opts.autoCopyMode)
+      selMgr->copySelection (selMgr->getClipboard (), selMgr->getPrimary ());
+}
+
+static void
+showSearchPrompt (bool found)
+{
+   std::string prompt = "Search: " + searchQuery;
+   if (!found)
+      prompt += " [not found]";
+   XStoreName (xDisplay, xWindow, prompt.c_str ());
+}
+
+static void
+endSearch ()
+{
+   searchMode = false;
+   XStoreName (xDisplay, xWindow, windowTitle.c_str ());
+}
+
+static void
+onSearchKey (KeySym ks, const char* buffer, int nbytes, Time time)
+{
+   switch (ks)
+   {
+   case XK_Escape:
+      vt->selectClear ();
+      endSearch ();
+      return;
+   case XK_Return: case XK_KP_Enter:
+   {
+      // Finish with the match as the primary selection
+      setPrimarySelection (vt->selectFinish (), time);
+      endSearch ();
+      return;
+   }
+   case XK_Up: case XK_KP_Up:
+      showSearchPrompt (vt->search (searchQuery, true, true));
+      return;
+   case XK_Down: case XK_KP_Down:
+      showSearchPrompt (vt->search (searchQuery, false, true));
+      return;
+   case XK_BackSpace:
+      // Drop the last (possibly multi-byte) character
+      while (searchQuery.size () && (searchQuery.back () & 0xc0) == 0x80)
+         searchQuery.pop_back ();
+      if (searchQuery.size ())
+         searchQuery.pop_back ();
+      break;
+   default:
+      if (nbytes == 0 || (unsigned char) buffer [0] < ' ' || buffer [0] == 127)
+         return;
+      searchQuery.append (buffer, nbytes);
+      break;
+   }
+
+   // The query got changed: the current match might still do
+   if (searchQuery.empty ())
+   {
+      vt->selectClear ();
+      showSearchPrompt (true);
+   }
+   else
+      showSearchPrompt (vt->search (searchQuery, true, false));
+}
+
 static bool
 onKeyPress (XEvent& event, XIC& xic, int ptyFd)
 {
@@ -504,6 +594,25 @@ onKeyPress (XEvent& event, XIC& xic, int ptyFd)
       vt->selectRectangularModeToggle ();
       return false;
    }
+   if (ks == XK_F && mod == VtModifier::shift_control)
+   {
+      if (searchMode)
+         showSearchPrompt (vt->search (searchQuery, true, true));
+      else
+      {
+         searchMode = true;
+         searchQuery.clear ();
+         vt->selectClear ();
+         showSearchPrompt (true);
+      }
+      return false;
+   }
+   if (searchMode)
+   {
+      if (!XFilterEvent (&event, xkevt.window))
+         onSearchKey (ks, buffer, nbytes, xkevt.time);
+      return false;
+   }
 
    if (XFilterEvent (&event, xkevt.window))
       return false;
@@ -861,19 +970,10 @@ onButtonRelease (XButtonEvent& xbevt, bool& holdPtyIn)
    switch (xbevt.button)
    {
    case 1: case 3:
-   {
-      std::string utf8_sel;
       holdPtyIn = false;
       mouseCtx.selectionOngoing = false;
-      if (vt->selectFinish (utf8_sel))
-      {
-         selMgr->setSelection (selMgr->getPrimary (), xbevt.time, utf8_sel);
-         if (opts.autoCopyMode)
-            selMgr->copySelection (selMgr->getClipboard (),
-                                   selMgr->getPrimary ());
-      }
-   }
-   break;
+      setPrimarySelection (vt->selectFinish (), xbevt.time);
+      break;
    case 2:
       selMgr->getSelection (selMgr->getPrimary (), xbevt.time, pasteCb);
       break;
@@ -897,6 +997,9 @@ static bool
 x11Event (XEvent& event, XIC& xic, int ptyFd, bool& destroyed, bool& holdPtyIn)
 {
    static bool exposed = false;
+   static bool mapped = false;
+   static bool obscured = false;
+   const bool wasVisible = mapped && !obscured;
    bool redraw = false;
    destroyed = false;
 
@@ -937,9 +1040,15 @@ x11Event (XEvent& event, XIC& xic, int ptyFd, bool& destroyed, bool& holdPtyIn)
       break;
    case MapNotify:
       logT << "MapNotify" << std::endl;
+      mapped = true;
       break;
    case UnmapNotify:
       logT << "UnmapNotify" << std::endl;
+      mapped = false;
+      break;
+   case VisibilityNotify:
+      logT << "VisibilityNotify: " << event.xvisibility.state << std::endl;
+      obscured = event.xvisibility.state == VisibilityFullyObscured;
       break;
    case DestroyNotify:
       logT << "DestroyNotify" << std::endl;
@@ -987,6 +1096,15 @@ x11Event (XEvent& event, XIC& xic, int ptyFd, bool& destroyed, bool& holdPtyIn)
       break;
    }
 
+   // Rendering is paused while the window cannot be seen; the Vterm keeps
+   // on updating its frame, to be redrawn in full once the window shows.
+   const bool visible = mapped && !obscured;
+   if (visible != wasVisible)
+   {
+      renderer->setVisible (visible);
+      redraw = redraw || visible;
+   }
+
    if (exposed && redraw) {
       vt->redraw ();
    }
@@ -1009,8 +1127,13 @@ eventLoop (XIC& xic, int ptyFd)
    bool holdPtyIn = false;
    while (1)
    {
-      pollset [0].fd = holdPtyIn ? -ptyFd : ptyFd;
-      if (poll (pollset, 2, -1) < 0)
+      // Keep polling for writability while output is queued for the child,
+      // even while input from it is being held.
+      short ptyEvents = (holdPtyIn ? 0 : POLLIN) |
+                        (vt->hasPendingOutput () ? POLLOUT : 0);
+      pollset [0].fd = ptyEvents ? ptyFd : -ptyFd;
+      pollset [0].events = ptyEvents;
+      if (poll (pollset, 2, vt->getRefreshTimeout ()) < 0)
       {
          if (errno == EINTR)
             continue;
@@ -1018,6 +1141,9 @@ eventLoop (XIC& xic, int ptyFd)
             return false;
       }
 
+      if (pollset [0].revents & POLLOUT)
+         vt->flushOutput ();
+
       if (pollset [0].revents & (POLLIN | POLLHUP))
          if (vt->readPty ())
             return false;
@@ -1032,6 +1158,8 @@ eventLoop (XIC& xic, int ptyFd)
             if (x11Event (event, xic, ptyFd, destroyed, holdPtyIn))
                return destroyed;
          }
+
+      vt->flushRefresh ();
    }
 }
 
@@ -1041,14 +1169,18 @@ handleOsc (int cmd, const std::string& arg)
    switch (cmd)
    {
    case 0: // Change Icon Name & Window Title
-      XStoreName (xDisplay, xWindow, arg.c_str ());
+      windowTitle = arg;
+      if (!searchMode)
+         XStoreName (xDisplay, xWindow, arg.c_str ());
       XSetIconName (xDisplay, xWindow, arg.c_str ());
       break;
    case 1: // Change Icon Name
       XSetIconName (xDisplay, xWindow, arg.c_str ());
       break;
    case 2: // Change Window Title
-      XStoreName (xDisplay, xWindow, arg.c_str ());
+      windowTitle = arg;
+      if (!searchMode)
+         XStoreName (xDisplay, xWindow, arg.c_str ());
       break;
    case 52: // Manipulate Selection Data
    {
@@ -1160,6 +1292,40 @@ printGLInfo (EGLDisplay eglDpy)
              << std::endl;
 }
 
+// Print the counters of work done, if asked to (with -stats)
+static void
+dumpStats ()
+{
+   if (!opts.statsFile)
+      return;
+
+   if (strcmp (opts.statsFile, "-") == 0)
+   {
+      zutty::stats::print (std::cerr);
+      return;
+   }
+
+   std::ofstream ofs (opts.statsFile);
+   if (ofs)
+      zutty::stats::print (ofs);
+   else
+      logE << "Could not write counters to " << opts.statsFile << std::endl;
+}
+
+static void
+exitOnXError ()
+{
+   renderer = nullptr; // ~Renderer () shuts down renderer thread
+   dumpStats ();
+
+   // N.B.: X errors may come while the fonts are still being loaded on
+   // a thread of their own (see main), so skip the static destructors,
+   // which would tear down state still in use there.
+   fflush (stdout);
+   std::cerr.flush ();
+   _exit (1);
+}
+
 static int
 handleXError (Display* dpy, XErrorEvent* ev)
 {
@@ -1167,8 +1333,7 @@ handleXError (Display* dpy, XErrorEvent* ev)
    XmuPrintDefaultErrorMessage(dpy, ev, stdout);
    fflush (stdout);
 
-   renderer = nullptr; // ~Renderer () shuts down renderer thread
-   exit (1);
+   exitOnXError ();
    return 0;
 }
 
@@ -1179,11 +1344,79 @@ handleXIOError (Display* dpy)
    logE << "Fatal IO error " << err << " (" << strerror (err)
         << ") on X server " << DisplayString (dpy) << std::endl;
 
-   renderer = nullptr; // ~Renderer () shuts down renderer thread
-   exit (1);
+   exitOnXError ();
    return 0;
 }
 
+static bool
+openDisplay ()
+{
+   xDisplay = XOpenDisplay (opts.display);
+   if (!xDisplay)
+   {
+      opts.handlePrintOpts ();
+      std::cout << "Error: couldn't open display '" << opts.display << "'"
+                << std::endl;
+      return false;
+   }
+   opts.setDisplay (xDisplay);
+
+   opts.parse ();
+   return true;
+}
+
+// The options (and locale, for the widths of characters) deciding what
+// Fontpack gets loaded
+static std::string
+getFontKey ()
+{
+   std::ostringstream oss;
+   oss << opts.fontname << '|' << (opts.dwfontname ? opts.dwfontname : "")
+       << '|' << opts.dpi << '|' << opts.atlasSize
+       << '|' << setlocale (LC_CTYPE, nullptr);
+   return oss.str ();
+}
+
+/* Run as the daemon (see daemon.h), loading the fonts up front. Returns
+ * in the process forked for each window, with the command line of the
+ * client in argc and argv, and the options parsed from it. The fonts of
+ * the daemon are kept if the client asks for the same ones.
+ */
+static bool
+runDaemon (int& argc, char**& argv)
+{
+   fontpk = std::make_unique <Fontpack> (opts.fontname, opts.dwfontname);
+   const std::string fontKey = getFontKey ();
+
+   // N.B.: the connection is not to be shared with the forked processes
+   XCloseDisplay (xDisplay);
+   xDisplay = nullptr;
+
+   const std::vector <std::string> args = zutty::serveWindows ();
+   zutty::stats::restart ();
+   static std::vector <char*> clientArgv;
+   clientArgv.push_back (argv [0]);
+   for (const auto& arg: args)
+      clientArgv.push_back (strdup (arg.c_str ()));
+   clientArgv.push_back (nullptr);
+   argc = clientArgv.size () - 1;
+   argv = clientArgv.data ();
+
+   setlocale (LC_ALL, ""); // that of the client
+   opts.initialize (&argc, argv);
+   if (!opts.display)
+   {
+      std::cout << "Error: DISPLAY not set!" << std::endl;
+      return false;
+   }
+   if (!openDisplay ())
+      return false;
+
+   if (getFontKey () != fontKey)
+      fontpk = nullptr;
+   return true;
+}
+
 int
 main (int argc, char* argv[])
 {
@@ -1228,6 +1461,9 @@ main (int argc, char* argv[])
    XSetErrorHandler(handleXError);
    XSetIOErrorHandler(handleXIOError);
 
+   // N.B.: the options parsed are taken out of argv; a client passes on
+   // all of them as given
+   const std::vector <std::string> args (argv + 1, argv + argc);
    opts.initialize (&argc, argv);
    if (!opts.display)
    {
@@ -1236,17 +1472,14 @@ main (int argc, char* argv[])
       return -1;
    }
 
-   xDisplay = XOpenDisplay (opts.display);
-   if (!xDisplay)
-   {
-      opts.handlePrintOpts ();
-      std::cout << "Error: couldn't open display '" << opts.display << "'"
-                << std::endl;
+   if (opts.getBool ("client"))
+      return zutty::runClient (args);
+
+   if (!openDisplay ())
       return -1;
-   }
-   opts.setDisplay (xDisplay);
 
-   opts.parse ();
+   if (opts.getBool ("daemon") && !runDaemon (argc, argv))
+      return -1;
 
    if (opts.verbose)
       opts.printVersion ();
@@ -1277,6 +1510,19 @@ main (int argc, char* argv[])
       validateShell (progPath);
    }
 
+   // Load the fonts (unless the daemon has them already) while setting up
+   // EGL and the input method, which do not depend on them; the window
+   // size does, so it has to wait. Any exception thrown while loading is
+   // passed on by get () below.
+   std::future <std::unique_ptr <Fontpack>> fontpkLoad;
+   if (!fontpk)
+      fontpkLoad = std::async (Fontpack::getLaunchPolicy (),
+                               [] ()
+                               {
+                                  return std::make_unique <Fontpack> (
+                                     opts.fontname, opts.dwfontname);
+                               });
+
    eglDpy = eglGetDisplay ((EGLNativeDisplayType)xDisplay);
    if (!eglDpy)
    {
@@ -1290,6 +1536,16 @@ main (int argc, char* argv[])
       return -1;
    }
 
+   const char* eglExtensions = eglQueryString (eglDpy, EGL_EXTENSIONS);
+   if (eglExtensions &&
+       strstr (eglExtensions, "EGL_KHR_swap_buffers_with_damage"))
+      eglSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+         eglGetProcAddress ("eglSwapBuffersWithDamageKHR");
+   else if (eglExtensions &&
+            strstr (eglExtensions, "EGL_EXT_swap_buffers_with_damage"))
+      eglSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+         eglGetProcAddress ("eglSwapBuffersWithDamageEXT");
+
    xim = XOpenIM (xDisplay, nullptr, nullptr, nullptr);
    if (xim == nullptr)
    {
@@ -1324,15 +1580,27 @@ main (int argc, char* argv[])
       }
    }
 
-   fontpk = std::make_unique <Fontpack> (opts.fontname,
-                                         opts.dwfontname);
+   if (fontpkLoad.valid ())
+      fontpk = fontpkLoad.get ();
+   zutty::stats::mark (zutty::stats::FontsReadyNs);
 
    int winWidth = 2 * opts.border + opts.nCols * fontpk->getPx ();
    int winHeight = 2 * opts.border + opts.nRows * fontpk->getPy ();
 
+   windowTitle = opts.title;
    makeXWindow (opts.title,
                 winWidth, winHeight, fontpk->getPx (), fontpk->getPy (),
                 eglDpy, eglCtx, eglSurface);
+   zutty::stats::mark (zutty::stats::WindowReadyNs);
+
+   // Start the shell as soon as WINDOWID is set for it to inherit, so it
+   // starts up while the render thread sets up GL. Its output waits in
+   // the pty until the Vterm is there to read it.
+   setupSignals ();
+   if (opts.recordFile)
+      zutty::record::start (opts.recordFile, opts.nCols, opts.nRows);
+   int ptyFd = startShell (progPath, shArgv);
+   zutty::stats::mark (zutty::stats::ShellForkNs);
 
    XMapWindow (xDisplay, xWindow);
 
@@ -1364,14 +1632,15 @@ main (int argc, char* argv[])
          if (opts.glinfo)
             printGLInfo (eglDpy);
       },
-      [eglDpy, eglSurface] ()
+      [eglDpy, eglSurface] (const EGLint* rects, EGLint nRects)
       {
-         eglSwapBuffers (eglDpy, eglSurface);
+         if (nRects && eglSwapBuffersWithDamage)
+            eglSwapBuffersWithDamage (eglDpy, eglSurface, rects, nRects);
+         else
+            eglSwapBuffers (eglDpy, eglSurface);
       },
       fontpk.get ());
 
-   setupSignals ();
-   int ptyFd = startShell (progPath, shArgv);
    vt = std::make_unique <Vterm> (fontpk->getPx (), fontpk->getPy (),
                                   winWidth, winHeight, ptyFd);
    vt->setRefreshHandler ([] (const zutty::Frame& f) { renderer->update (f); });
@@ -1384,6 +1653,7 @@ main (int argc, char* argv[])
    bool destroyed = eventLoop (xic, ptyFd);
 
    renderer = nullptr; // ~Renderer () shuts down renderer thread
+   dumpStats ();
 
    eglDestroyContext (eglDpy, eglCtx);
    eglDestroySurface (eglDpy, eglSurface);
@@ -9,6 +9,7 @@
  * See the file LICENSE for the full license.
  */
 
+#include "log.h"
 #include "options.h"
 
 #include <X11/Xlib.h>
@@ -16,8 +17,11 @@
 #include <X11/Xmu/Atoms.h>
 
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -202,6 +206,12 @@ namespace zutty
    void
    Options::initialize (int* argc, char** argv)
    {
+      // N.B.: called again in the processes forked by the daemon
+      if (xrmOptionsDb)
+         XrmDestroyDatabase (xrmOptionsDb);
+      xrmOptionsDb = nullptr;
+      dpy = nullptr;
+
       XrmInitialize ();
       XrmParseCommand (&xrmOptionsDb,
                        xrmOptionsTable.data (), xrmOptionsTable.size (),
@@ -288,6 +298,8 @@ namespace zutty
          fontname = get ("font");
          getGeometry (nCols, nRows);
          glinfo = getBool ("glinfo");
+         gpuTiles = getBool ("gpuTiles");
+         hud = getBool ("hud");
          shell = get ("shell", getenv ("SHELL"));
          if (!shell)
             shell = "bash";
@@ -307,10 +319,14 @@ namespace zutty
          boldColors = getBool ("boldColors");
          login = getBool ("login");
          showWraps = getBool ("showWraps");
+         statsFile = get ("stats");
+         recordFile = get ("record");
          quiet = getBool ("quiet");
          verbose = getBool ("verbose");
          modifyOtherKeys = getInteger ("modifyOtherKeys", 0, 2);
          dpi = getInteger ("dpi", 0, 65535);
+         readBudget = getInteger ("readBudget", 0, 1000);
+         atlasSize = getInteger ("atlasSize", 0, 65025);
       }
       catch (const std::exception& e)
       {
@@ -381,4 +397,49 @@ namespace zutty
       std::cout << std::endl;
    }
 
+   std::string
+   getCacheDir (bool create)
+   {
+      std::string dir;
+      const char* xdg = getenv ("XDG_CACHE_HOME");
+      const char* home = getenv ("HOME");
+      if (xdg && *xdg)
+         dir = std::string (xdg) + "/zutty";
+      else if (home && *home)
+         dir = std::string (home) + "/.cache/zutty";
+
+      if (create && !dir.empty ())
+      {
+         mkdir (dir.substr (0, dir.rfind ('/')).c_str (), 0700);
+         mkdir (dir.c_str (), 0700);
+      }
+      return dir;
+   }
+
+   bool
+   writeCacheFile (const std::string& path, const void* data, size_t len)
+   {
+      getCacheDir (true);
+
+      // Write to a temporary file first, so that concurrently starting
+      // instances never see a partially written cache file.
+      const std::string tmpPath = path + "." + std::to_string (getpid ());
+      {
+         std::ofstream ofs (tmpPath, std::ios::binary);
+         ofs.write ((const char*) data, len);
+         if (!ofs)
+         {
+            logW << "Failed to write cache file " << tmpPath << std::endl;
+            unlink (tmpPath.c_str ());
+            return false;
+         }
+      }
+      if (rename (tmpPath.c_str (), path.c_str ()) < 0)
+      {
+         unlink (tmpPath.c_str ());
+         return false;
+      }
+      return true;
+   }
+
 } // namespace zutty
@@ -51,11 +51,14 @@ namespace zutty
    static const std::vector <OptionDesc> optionsTable = {
       // option       parseType implValue hardDefault helpDescr
       {"altScroll",   NoArg,    "true",    "false",   "Alternate scroll mode"},
+      {"atlasSize",   SepArg,   nullptr,   "4096",    "Max. glyphs in atlas (0: load all)"},
       {"autoCopy",    NoArg,    "true",    "false",   "Sync primary to clipboard"},
       {"bg",          SepArg,   nullptr,   "#000",    "Background color"},
       {"boldColors",  NoArg,    "true",    "true",    "Enable bright for bold"},
       {"border",      SepArg,   nullptr,   "2",       "Border width in pixels"},
+      {"client",      NoArg,    "true",    "false",   "Open window via the daemon"},
       {"cr",          SepArg,   nullptr,   nullptr,   "Cursor color"},
+      {"daemon",      NoArg,    "true",    "false",   "Serve windows for -client"},
       {"display",     SepArg,   nullptr,   nullptr,   "Display to connect to"},
       {"dpi",         SepArg,   nullptr,   nullptr,   "Display resolution"},
       {"dwfont",      SepArg,   nullptr,   "",        "Double-width font to use"},
@@ -63,14 +66,19 @@ namespace zutty
       {"font",        SepArg,   nullptr,   "9x18",    "Font to use"},
       {"geometry",    SepArg,   nullptr,   "80x24",   "Terminal size in chars"},
       {"glinfo",      NoArg,    "true",    "false",   "Print OpenGL information"},
+      {"gpuTiles",    NoArg,    "true",    "false",   "Use tiled compute shader"},
       {"help",        NoArg,    "true",    "false",   "Print usage listing and quit"},
+      {"hud",         NoArg,    "true",    "false",   "Show performance counters"},
       {"listres",     NoArg,    "true",    "false",   "Print resource listing and quit"},
       {"login",       NoArg,    "true",    "false",   "Start shell as a login shell"},
       {"name",        SepArg,   nullptr,   nullptr,   "Instance name for Xrdb and WM_CLASS"},
+      {"readBudget",  SepArg,   nullptr,   "16",      "Pty input time per refresh in ms"},
+      {"record",      SepArg,   nullptr,   nullptr,   "Record pty session to file"},
       {"rv",          NoArg,    "true",    "false",   "Reverse video"},
       {"saveLines",   SepArg,   nullptr,   "500",     "Lines of scrollback history"},
       {"shell",       SepArg,   nullptr,   nullptr,   "Shell program to run"},
       {"showWraps",   NoArg,    "true",    "false",   "Show wrap marks at right margin"},
+      {"stats",       SepArg,   nullptr,   nullptr,   "Dump counters on exit (- for stderr)"},
       {"title",       SepArg,   nullptr,   "Zutty",   "Window title"},
       {"quiet",       NoArg,    "true",    "false",   "Silence logging output"},
       {"verbose",     NoArg,    "true",    "false",   "Output info messages"},
@@ -111,11 +119,15 @@ namespace zutty
       uint16_t nRows;
       uint16_t saveLines;
       uint16_t dpi;
+      uint16_t readBudget;
+      uint16_t atlasSize;
       const char* display;
       const char* dwfontname;
       const char* fontname;
       const char* name;
+      const char* recordFile;
       const char* shell;
+      const char* statsFile;
       const char* title;
       Color bg;
       Color cr;
@@ -125,6 +137,8 @@ namespace zutty
       bool autoCopyMode;
       bool boldColors;
       bool glinfo;
+      bool gpuTiles;
+      bool hud;
       bool login;
       bool showWraps;
       bool quiet;
@@ -146,6 +160,16 @@ namespace zutty
       int getInteger (const char* name, int min, int max);
    };
 
+   // The directory of files cached between runs: $XDG_CACHE_HOME/zutty
+   // (~/.cache/zutty by default), or empty if neither variable is set.
+   // If create is true, it is created (if not yet there).
+   std::string getCacheDir (bool create = false);
+
+   // Write data to the file at path in the cache directory (created if
+   // missing), replacing any file there; returns false on failure.
+   bool writeCacheFile (const std::string& path, const void* data,
+                        size_t len);
+
 } // namespace zutty
 
 extern zutty::Options opts;
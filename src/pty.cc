@@ -34,6 +34,7 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -143,6 +144,11 @@ namespace zutty
       }
       else // parent process
       {
+         // Output to the pty is queued by the terminal and written out as
+         // the child takes it, so writes must never block the event loop.
+         int flags = fcntl (fdm, F_GETFL);
+         if (flags < 0 || fcntl (fdm, F_SETFL, flags | O_NONBLOCK) < 0)
+            SYS_ERROR ("can't set master pty non-blocking: fcntl()");
          o_ptyFd = fdm;
       }
       return pid;
@@ -157,4 +163,12 @@ namespace zutty
          SYS_ERROR("TIOCSWINSZ on pty");
    }
 
+   // Is there input to be read from the pty without blocking?
+   bool
+   pty_hasInput (int ptyFd)
+   {
+      struct pollfd pfd = {ptyFd, POLLIN, 0};
+      return poll (&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+   }
+
 } // namespace zutty
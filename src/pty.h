@@ -20,4 +20,6 @@ namespace zutty
 
    void pty_resize (int ptyFd, int cols, int rows);
 
+   bool pty_hasInput (int ptyFd);
+
 } // namespace zutty
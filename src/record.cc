@@ -0,0 +1,169 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#include "log.h"
+#include "record.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+   using namespace zutty::record;
+
+   constexpr const char recordMagic [8] = {'Z','R','E','C','0','0','0','1'};
+
+   struct FileHeader
+   {
+      char magic [8];
+      uint16_t cols;
+      uint16_t rows;
+      uint32_t reserved;
+   };
+
+   struct EventHeader
+   {
+      uint64_t usecs;
+      uint32_t kind;
+      uint32_t size;
+   };
+
+   std::ofstream ofs;
+   std::chrono::steady_clock::time_point t0;
+
+   void
+   writeEvent (Kind kind, const void* payload, uint32_t size)
+   {
+      using namespace std::chrono;
+
+      EventHeader eh;
+      eh.usecs = duration_cast <microseconds> (
+         steady_clock::now () - t0).count ();
+      eh.kind = kind;
+      eh.size = size;
+      ofs.write ((const char*) &eh, sizeof (eh));
+      ofs.write ((const char*) payload, size);
+      if (!ofs)
+      {
+         logE << "Writing recording failed, stopped recording" << std::endl;
+         active = false;
+      }
+   }
+
+} // namespace
+
+namespace zutty
+{
+   namespace record
+   {
+      bool active = false;
+
+      bool
+      start (const char* path, uint16_t cols, uint16_t rows)
+      {
+         ofs.open (path, std::ios::binary | std::ios::trunc);
+         if (!ofs)
+         {
+            logE << "Could not open recording file " << path << std::endl;
+            return false;
+         }
+
+         FileHeader fh;
+         memcpy (fh.magic, recordMagic, sizeof (fh.magic));
+         fh.cols = cols;
+         fh.rows = rows;
+         fh.reserved = 0;
+         ofs.write ((const char*) &fh, sizeof (fh));
+
+         t0 = std::chrono::steady_clock::now ();
+         active = (bool) ofs;
+         logI << "Recording pty session to " << path << std::endl;
+         return active;
+      }
+
+      void
+      input (const uint8_t* data, size_t len)
+      {
+         if (active)
+            writeEvent (Input, data, len);
+      }
+
+      void
+      resize (uint16_t cols, uint16_t rows)
+      {
+         if (!active)
+            return;
+
+         const uint16_t payload [2] = {cols, rows};
+         writeEvent (Resize, payload, sizeof (payload));
+         ofs.flush (); // keep recordings of sessions that crash usable
+      }
+
+      bool
+      isRecording (const std::string& data)
+      {
+         return data.size () >= sizeof (FileHeader) &&
+            memcmp (data.data (), recordMagic, sizeof (recordMagic)) == 0;
+      }
+
+      bool
+      load (const std::string& data, uint16_t& cols, uint16_t& rows,
+            std::vector <Event>& events)
+      {
+         if (!isRecording (data))
+            return false;
+
+         FileHeader fh;
+         memcpy (&fh, data.data (), sizeof (fh));
+         cols = fh.cols;
+         rows = fh.rows;
+
+         size_t pos = sizeof (fh);
+         while (pos < data.size ())
+         {
+            EventHeader eh;
+            if (data.size () - pos < sizeof (eh))
+               return false;
+            memcpy (&eh, data.data () + pos, sizeof (eh));
+            pos += sizeof (eh);
+            if (data.size () - pos < eh.size)
+               return false;
+
+            Event ev;
+            ev.usecs = eh.usecs;
+            ev.kind = (Kind) eh.kind;
+            switch (ev.kind)
+            {
+            case Input:
+               ev.data.assign (data, pos, eh.size);
+               break;
+            case Resize:
+            {
+               uint16_t payload [2];
+               if (eh.size != sizeof (payload))
+                  return false;
+               memcpy (payload, data.data () + pos, sizeof (payload));
+               ev.cols = payload [0];
+               ev.rows = payload [1];
+               break;
+            }
+            default:
+               return false;
+            }
+            pos += eh.size;
+            events.push_back (std::move (ev));
+         }
+         return true;
+      }
+   }
+
+} // namespace zutty
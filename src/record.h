@@ -0,0 +1,67 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace zutty
+{
+   /* Recording of a pty session (with -record): every chunk of input
+    * read from the pty and every change of terminal size, stamped with
+    * the time since the start of recording. Replayed by zutty-bench, a
+    * recording reproduces the exact sequence of screen states of the
+    * session, without a shell, X11 window or GPU.
+    *
+    * The file starts with a header (magic and initial size in cells),
+    * followed by the events, each a header and a payload of its size:
+    * the bytes read for Input, and two uint16_t (cols, rows) for Resize.
+    * All numbers are in host byte order.
+    */
+   namespace record
+   {
+      enum Kind: uint32_t
+      {
+         Input = 1,
+         Resize = 2
+      };
+
+      struct Event
+      {
+         uint64_t usecs = 0; // time since the start of recording
+         Kind kind = Input;
+         uint16_t cols = 0;  // with Resize
+         uint16_t rows = 0;
+         std::string data;   // with Input
+      };
+
+      // Start writing a recording to path; returns false on failure
+      bool start (const char* path, uint16_t cols, uint16_t rows);
+
+      // Is a recording being written?
+      extern bool active;
+
+      void input (const uint8_t* data, size_t len);
+      void resize (uint16_t cols, uint16_t rows);
+
+      // Does data (the contents of a file) look like a recording?
+      bool isRecording (const std::string& data);
+
+      // Decode a recording; returns false if it is truncated or corrupt
+      // (events up to that point are still returned).
+      bool load (const std::string& data, uint16_t& cols, uint16_t& rows,
+                 std::vector <Event>& events);
+   }
+
+} // namespace zutty
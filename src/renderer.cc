@@ -10,13 +10,15 @@
  */
 
 #include "renderer.h"
+#include "stats.h"
 
-#include <cassert>
+#include <chrono>
+#include <cstring>
 
 namespace zutty
 {
    Renderer::Renderer (const std::function <void ()>& initDisplay,
-                       const std::function <void ()>& swapBuffers_,
+                       const SwapBuffersFn& swapBuffers_,
                        Fontpack* fontpk)
       : swapBuffers {swapBuffers_}
       , thr (&Renderer::renderThread, this, initDisplay, fontpk)
@@ -25,10 +27,10 @@ namespace zutty
 
    Renderer::~Renderer ()
    {
-      std::unique_lock <std::mutex> lk (mx);
-      done = true;
-      nextFrame.seqNo = ++seqNo;
-      lk.unlock ();
+      {
+         std::lock_guard <std::mutex> lk (mx);
+         done = true;
+      }
       cond.notify_one ();
       thr.join ();
    }
@@ -36,10 +38,58 @@ namespace zutty
    void
    Renderer::update (const Frame& frame)
    {
-      std::unique_lock <std::mutex> lk (mx);
-      nextFrame = frame;
-      nextFrame.seqNo = ++seqNo;
-      lk.unlock ();
+      Snapshot& snap = slots [backIx];
+      std::vector <uint8_t>& stale = staleRows [backIx];
+
+      if (snap.nCols != frame.nCols || snap.nRows != frame.nRows)
+      {
+         snap.nCols = frame.nCols;
+         snap.nRows = frame.nRows;
+         snap.cells.resize (frame.nCols * frame.nRows);
+         snap.damage.assign (frame.nRows, CharVdev::RowSpan ());
+         for (auto& sr: staleRows)
+            sr.assign (frame.nRows, 1);
+      }
+
+      // Bring the slot up to date, copying only rows that changed since
+      // it was last written, either in this update or previous ones.
+      for (uint16_t pY = 0; pY < frame.nRows; ++pY)
+      {
+         auto& span = snap.damage [pY];
+         uint8_t damaged = frame.getViewRowDamage (pY, span.start, span.end);
+         for (auto& sr: staleRows)
+            sr [pY] |= damaged;
+         if (stale [pY])
+         {
+            frame.copyViewRow (pY, snap.cells.data () + pY * frame.nCols);
+            stale [pY] = 0;
+         }
+      }
+
+      snap.seqNo = ++seqNo;
+      snap.winPx = frame.winPx;
+      snap.winPy = frame.winPy;
+      snap.cursor = frame.getCursor ();
+      snap.selection = frame.getSnappedSelection ();
+
+      backIx = readyIx.exchange (backIx | freshFlag) & ~freshFlag;
+
+      // N.B.: Taking the (otherwise unused) lock before notifying ensures
+      // the consumer is either waiting already, or will see the new slot.
+      {
+         std::lock_guard <std::mutex> lk (mx);
+      }
+      cond.notify_one ();
+   }
+
+   void
+   Renderer::setVisible (bool visible_)
+   {
+      {
+         std::lock_guard <std::mutex> lk (mx);
+         visible = visible_;
+         hidden |= !visible_;
+      }
       cond.notify_one ();
    }
 
@@ -50,56 +100,82 @@ namespace zutty
       initDisplay ();
 
       charVdev = std::make_unique <CharVdev> (fontpk);
+      stats::mark (stats::GlReadyNs);
 
-      Frame lastFrame;
+      uint64_t lastSeqNo = 0;
       bool delta = false;
 
+      // The counters last shown by the HUD, and when they were sampled
+      using Clock = std::chrono::steady_clock;
+      stats::Sample hudSample = stats::sample ();
+      Clock::time_point hudTime = Clock::now ();
+
       while (1)
       {
-         std::unique_lock <std::mutex> lk (mx);
-         cond.wait (lk,
-                    [&] ()
-                    {
-                       return lastFrame.seqNo != nextFrame.seqNo;
-                    });
+         {
+            std::unique_lock <std::mutex> lk (mx);
+            cond.wait (lk,
+                       [&] ()
+                       {
+                          return done || (visible && (readyIx & freshFlag));
+                       });
+
+            if (done)
+               return;
+
+            // Window contents are lost while not visible
+            if (hidden)
+               delta = false;
+            hidden = false;
+         }
 
-         if (done)
-            return;
+         frontIx = readyIx.exchange (frontIx) & ~freshFlag;
+         const Snapshot& snap = slots [frontIx];
 
-         if (lastFrame.seqNo + 1 != nextFrame.seqNo)
+         if (lastSeqNo + 1 != snap.seqNo)
             delta = false;
+         lastSeqNo = snap.seqNo;
 
-         lastFrame = nextFrame;
-         lk.unlock ();
-
-         if (charVdev->resize (lastFrame.winPx, lastFrame.winPy))
+         if (charVdev->resize (snap.winPx, snap.winPy))
             delta = false;
 
+         if (opts.hud && Clock::now () - hudTime >= std::chrono::seconds (1))
          {
-            CharVdev::Mapping m = charVdev->getMapping ();
-            assert (m.nCols == lastFrame.nCols);
-            assert (m.nRows == lastFrame.nRows);
-
-            if (delta)
-               lastFrame.deltaCopyCells (m.cells);
-            else
-               lastFrame.fullCopyCells (m.cells);
+            const stats::Sample s = stats::sample ();
+            const Clock::time_point t = Clock::now ();
+            const std::chrono::duration <double> secs = t - hudTime;
+            charVdev->setOverlay (stats::formatHud (hudSample, s,
+                                                    secs.count ()));
+            hudSample = s;
+            hudTime = t;
          }
 
+         delta = charVdev->setCells (snap.nCols, snap.nRows,
+                                     snap.cells.data (), snap.damage.data (),
+                                     delta);
+         stats::add (delta ? stats::DeltaFrames : stats::FullFrames, 1);
          charVdev->setDeltaFrame (delta);
-         charVdev->setCursor (lastFrame.getCursor ());
-         charVdev->setSelection (lastFrame.getSnappedSelection ());
+         charVdev->setCursor (snap.cursor);
+         charVdev->setSelection (snap.selection);
 
-         if (lastFrame.seqNo == nextFrame.seqNo)
+         if (readyIx & freshFlag)
          {
-            charVdev->draw ();
-            swapBuffers ();
-            delta = true;
+            // skip drawing outdated frame; force full redraw next time
+            delta = false;
+            stats::add (stats::FramesSkipped, 1);
          }
          else
          {
-            // skip drawing outdated frame; force full redraw next time
-            delta = false;
+            if (charVdev->draw ())
+            {
+               const auto& damage = charVdev->getSwapDamage ();
+               const Clock::time_point t0 = Clock::now ();
+               swapBuffers (damage.data (), damage.size () / 4);
+               stats::add (stats::SwapNs, stats::nsSince (t0));
+               stats::add (stats::FramesDrawn, 1);
+               stats::mark (stats::FirstFrameNs);
+            }
+            delta = true;
          }
       }
    }
@@ -14,32 +14,71 @@
 #include "charvdev.h"
 #include "frame.h"
 
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 namespace zutty
 {
    class Renderer
    {
    public:
+      // swapBuffers receives the damaged (x, y, width, height) rectangles;
+      // if there are none, the whole window is to be considered damaged.
+      using SwapBuffersFn = std::function <void (const EGLint*, EGLint)>;
+
       Renderer (const std::function <void ()>& initDisplay,
-                const std::function <void ()>& swapBuffers,
+                const SwapBuffersFn& swapBuffers,
                 Fontpack* fontpk);
 
       ~Renderer ();
 
       void update (const Frame& frame);
 
+      // While the window is not visible (unmapped or fully obscured),
+      // updates are still taken, but nothing is drawn; the first frame
+      // drawn after it becomes visible again is a full redraw.
+      void setVisible (bool visible);
+
    private:
+      // Consistent copy of the visible part of a Frame, owned by either
+      // the producer (pty thread), the consumer (render thread) or neither
+      // of them (the slot ready to be picked up) at any time.
+      struct Snapshot
+      {
+         uint64_t seqNo = 0;
+         uint16_t winPx = 0;
+         uint16_t winPy = 0;
+         uint16_t nCols = 0;
+         uint16_t nRows = 0;
+         CharVdev::Cursor cursor;
+         Rect selection;
+         std::vector <CharVdev::Cell> cells;
+         std::vector <CharVdev::RowSpan> damage; // changes since seqNo - 1
+      };
+
+      // Triple buffer: the index of the ready slot, plus a flag
+      // telling if it holds a snapshot not yet seen by the consumer.
+      constexpr const static int freshFlag = 4;
+      Snapshot slots [3];
+      std::atomic <int> readyIx {0};
+      int backIx = 1;  // owned by the producer
+      int frontIx = 2; // owned by the consumer
+
+      // Per slot: rows changed since it was last written (producer only)
+      std::vector <uint8_t> staleRows [3];
+
       std::unique_ptr <CharVdev> charVdev;
-      const std::function <void ()> swapBuffers;
-      Frame nextFrame;
+      const SwapBuffersFn swapBuffers;
       uint64_t seqNo = 0;
       bool done = false;
+      bool visible = true;
+      bool hidden = false; // not visible at some point since the last draw
 
       std::condition_variable cond;
       std::mutex mx;
@@ -47,6 +86,7 @@ namespace zutty
 
       void renderThread (const std::function <void ()>& initDisplay,
                          Fontpack* fontpk);
+
    };
 
 } // namespace zutty
@@ -0,0 +1,393 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#include "scrollback.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+   using Cell = zutty::CharVdev::Cell;
+
+   /* The attributes of a cell (flags, fg and bg, but neither the code
+    * point nor any padding) as five bytes, taken straight from the
+    * cell's memory layout: bytes 2 (flags), 4 and 5 (fg) and 6 and 7 (bg).
+    */
+   constexpr const int attrBytes = 5;
+
+   // Fail to build rather than corrupt the scrollback if the layout of a
+   // cell (or the byte order of its memory) is not the one assumed here.
+   static_assert (sizeof (Cell) == sizeof (uint64_t), "Cell size");
+   static_assert (offsetof (Cell, uc_pt) == 0 &&
+                  offsetof (Cell, _fill0) == 3 &&
+                  offsetof (Cell, fg) == 4 &&
+                  offsetof (Cell, bg) == 6, "Cell layout");
+   static_assert (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Byte order");
+
+   inline uint64_t
+   getAttrs (const Cell& cell)
+   {
+      uint64_t w;
+      memcpy (&w, &cell, sizeof (w));
+      return (w >> 16 & 0xff) | (w >> 32) << 8;
+   }
+
+   // Whether two cells are equal in code point and attributes
+   inline bool
+   sameCell (const Cell& a, const Cell& b, uint64_t mask = 0xffffffff00ffffff)
+   {
+      uint64_t wa, wb;
+      memcpy (&wa, &a, sizeof (wa));
+      memcpy (&wb, &b, sizeof (wb));
+      return !((wa ^ wb) & mask);
+   }
+
+   // Whether two cells have the same attributes (regardless of code point)
+   inline bool
+   sameAttrs (const Cell& a, const Cell& b)
+   {
+      return sameCell (a, b, 0xffffffff00ff0000);
+   }
+
+   inline void
+   setCell (Cell& cell, uint16_t code, uint64_t attrs)
+   {
+      const uint64_t w = code | (attrs & 0xff) << 16 | (attrs >> 8) << 32;
+      memcpy (static_cast <void*> (&cell), &w, sizeof (w));
+   }
+
+   // Worst case: each cell a run of its own, with a 3-byte code
+   constexpr const size_t maxCellBytes = 3 + attrBytes + 3;
+
+   // Shorter runs of identical cells are stored as (part of) text
+   constexpr const uint16_t minRepeatRun = 8;
+
+} // namespace
+
+namespace zutty
+{
+   Scrollback::Scrollback (uint32_t maxRows_)
+      : maxRows (maxRows_)
+   {}
+
+   size_t
+   Scrollback::getBytes () const
+   {
+      size_t bytes = 0;
+      for (const auto& page: pages)
+         bytes += page.data.capacity () +
+            page.offsets.capacity () * sizeof (uint32_t);
+      return bytes;
+   }
+
+   void
+   Scrollback::clear ()
+   {
+      pages.clear ();
+      firstSeq = pagesSeq = endSeq;
+   }
+
+   /* Each run of cells with equal attributes is stored as:
+    *  - its length (in cells) times 2, plus 1 for a run of identical
+    *    cells, as a variable length integer (7 bits per byte, LSB first);
+    *  - the attributes (5 bytes, see getAttrs);
+    *  - the code of each cell as UTF-8, or only once if all identical.
+    */
+   void
+   Scrollback::push (const CharVdev::Cell* row, uint16_t nCols)
+   {
+      if (!maxRows)
+         return;
+
+      if (pages.empty () || pages.back ().offsets.size () == rowsPerPage)
+      {
+         // Expect a new page to take about as much space as the last one,
+         // to avoid repeatedly growing its data while it is filled
+         size_t reserve = nCols * rowsPerPage / 4;
+         if (pages.size ())
+         {
+            auto& data = pages.back ().data;
+            if (data.capacity () > data.size () + data.size () / 4)
+               data.shrink_to_fit ();
+            reserve = data.size () + data.size () / 8;
+         }
+         pages.emplace_back ();
+         pages.back ().data.reserve (reserve);
+         pages.back ().offsets.reserve (rowsPerPage);
+      }
+
+      if (packBuf.size () < nCols * maxCellBytes)
+         packBuf.resize (nCols * maxCellBytes);
+      uint8_t* p = packBuf.data ();
+
+      auto putRun = [&p, row] (uint16_t x, uint16_t n, bool repeat)
+      {
+         uint32_t len = (uint32_t) n << 1 | repeat;
+         for (; len >= 0x80; len >>= 7)
+            *p++ = (len & 0x7f) | 0x80;
+         *p++ = len;
+
+         const uint64_t attrs = getAttrs (row [x]);
+         for (int k = 0; k < attrBytes; ++k)
+            *p++ = attrs >> (8 * k);
+
+         for (uint16_t k = x; k < x + (repeat ? 1 : n); ++k)
+         {
+            if (row [k].uc_pt < 0x80)
+               *p++ = row [k].uc_pt;
+            else
+               Utf8Encoder::pushUnicode (row [k].uc_pt,
+                                         [&p] (uint8_t b) { *p++ = b; });
+         }
+      };
+
+      for (uint16_t x = 0; x < nCols; )
+      {
+         // A run of identical cells (typically blanks) is compared in
+         // blocks (padding included) once long enough, cell by cell else
+         uint16_t n = 1;
+         while (x + n < nCols && n < minRepeatRun &&
+                sameCell (row [x + n], row [x]))
+            ++n;
+         if (n == minRepeatRun)
+         {
+            const CharVdev::Cell* c = row + x + n;
+            const CharVdev::Cell* const end = row + nCols;
+            while (end - c >= minRepeatRun &&
+                   memcmp (c, row + x, sizeof (CharVdev::Cell) *
+                           minRepeatRun) == 0)
+               c += minRepeatRun;
+            while (c < end && sameCell (*c, row [x]))
+               ++c;
+            n = c - (row + x);
+            putRun (x, n, true);
+            x += n;
+            continue;
+         }
+
+         // Otherwise a run of text, up to where a run of identical cells
+         // starts (cells of equal attributes and code, within the run)
+         n = 1;
+         uint16_t nSame = 1;
+         while (x + n < nCols && sameAttrs (row [x + n], row [x]))
+         {
+            nSame = row [x + n].uc_pt == row [x + n - 1].uc_pt
+               ? nSame + 1 : 1;
+            ++n;
+            if (nSame == minRepeatRun)
+            {
+               n -= minRepeatRun;
+               break;
+            }
+         }
+         putRun (x, n, false);
+         x += n;
+      }
+      Page& page = pages.back ();
+      page.offsets.push_back (page.data.size ());
+      page.data.insert (page.data.end (), packBuf.data (), p);
+      ++endSeq;
+
+      // Drop the oldest row, and its page once all of its rows are gone
+      if (size () > maxRows)
+      {
+         ++firstSeq;
+         if (firstSeq - pagesSeq == rowsPerPage)
+         {
+            pages.pop_front ();
+            pagesSeq = firstSeq;
+         }
+      }
+   }
+
+   void
+   Scrollback::pop (CharVdev::Cell* dest, uint16_t nCols)
+   {
+      if (!size ())
+         return;
+
+      const uint64_t seq = endSeq - 1;
+      unpack (seq, dest, nCols);
+
+      Page& page = pages.back ();
+      page.data.resize (page.offsets.back ());
+      page.offsets.pop_back ();
+      page.indexed &= ~(1 << page.offsets.size () / blockRows);
+      if (page.offsets.empty ())
+         pages.pop_back ();
+      --endSeq;
+
+      // Invalidate the cache entry, as the sequence number will be reused
+      if (cacheSeq.size () && cacheSeq [seq % cacheRows] == seq + 1)
+         cacheSeq [seq % cacheRows] = 0;
+   }
+
+   const CharVdev::Cell*
+   Scrollback::getRow (uint32_t k, uint16_t nCols) const
+   {
+      if (cacheCols != nCols)
+      {
+         cache.assign (cacheRows * nCols, CharVdev::Cell ());
+         cacheSeq.assign (cacheRows, 0);
+         cacheCols = nCols;
+      }
+
+      const uint64_t seq = endSeq - k;
+      CharVdev::Cell* row = cache.data () + (seq % cacheRows) * nCols;
+      if (cacheSeq [seq % cacheRows] != seq + 1)
+      {
+         unpack (seq, row, nCols);
+         cacheSeq [seq % cacheRows] = seq + 1;
+      }
+      return row;
+   }
+
+   void
+   Scrollback::markColors (std::vector <bool>& used) const
+   {
+      for (uint64_t seq = firstSeq; seq < endSeq; ++seq)
+         decode (seq,
+                 [&] (uint16_t, uint64_t attrs)
+                 {
+                    used [attrs >> 8 & 0xffff] = true;
+                    used [attrs >> 24 & 0xffff] = true;
+                 });
+   }
+
+   uint32_t
+   Scrollback::skipRows (uint32_t k, const std::vector <uint32_t>& trigrams,
+                         bool older) const
+   {
+      if (trigrams.empty () || k == 0 || k > size ())
+         return 0;
+
+      const uint64_t seq = endSeq - k;
+      const Page& page = pages [(seq - pagesSeq) / rowsPerPage];
+      const uint32_t rowIx = (seq - pagesSeq) % rowsPerPage;
+      const uint32_t block = rowIx / blockRows;
+      if (page.offsets.size () < (block + 1) * blockRows)
+         return 0;
+
+      if (!(page.indexed & 1 << block))
+         indexBlock (page, seq - rowIx, block);
+
+      const uint64_t* bits = page.index.data () + block * indexWords;
+      for (uint32_t t: trigrams)
+         if (!(bits [t / 64] >> (t % 64) & 1))
+            return older
+               ? std::min (rowIx % blockRows + 1, size () - k + 1)
+               : std::min (blockRows - rowIx % blockRows, k);
+      return 0;
+   }
+
+   void
+   Scrollback::indexBlock (const Page& page, uint64_t seq0,
+                           uint32_t block) const
+   {
+      if (page.index.empty ())
+         page.index.resize (rowsPerPage / blockRows * indexWords);
+      uint64_t* bits = page.index.data () + block * indexWords;
+      std::fill (bits, bits + indexWords, 0);
+
+      for (uint32_t r = block * blockRows; r < (block + 1) * blockRows; ++r)
+      {
+         uint16_t a = 0, b = 0, n = 0;
+         decode (seq0 + r,
+                 [&] (uint16_t code, uint64_t attrs)
+                 {
+                    if (attrs & 2) // dwidth_cont
+                       return;
+                    code = foldCase (code);
+                    if (++n >= 3)
+                    {
+                       const uint32_t t = getTrigram (a, b, code);
+                       bits [t / 64] |= (uint64_t) 1 << (t % 64);
+                    }
+                    a = b;
+                    b = code;
+                 });
+      }
+      page.indexed |= 1 << block;
+   }
+
+   template <typename Fn>
+   void
+   Scrollback::decode (uint64_t seq, Fn&& fn) const
+   {
+      const uint64_t pageIx = (seq - pagesSeq) / rowsPerPage;
+      const uint32_t rowIx = (seq - pagesSeq) % rowsPerPage;
+      const Page& page = pages [pageIx];
+      const uint8_t* p = page.data.data () + page.offsets [rowIx];
+      const uint8_t* const end = page.data.data () +
+         (rowIx + 1 < page.offsets.size () ? page.offsets [rowIx + 1]
+                                           : page.data.size ());
+
+      while (p < end)
+      {
+         uint32_t len = 0;
+         for (int shift = 0; ; shift += 7)
+         {
+            len |= (uint32_t) (*p & 0x7f) << shift;
+            if (!(*p++ & 0x80))
+               break;
+         }
+         const bool repeat = len & 1;
+         const uint16_t n = len >> 1;
+
+         uint64_t attrs = 0;
+         for (int k = 0; k < attrBytes; ++k)
+            attrs |= (uint64_t) *p++ << (8 * k);
+
+         uint16_t code = 0;
+         for (uint16_t k = 0; k < n; ++k)
+         {
+            if (!repeat || !k)
+            {
+               code = *p++;
+               if (code >= 0xe0)
+               {
+                  code = (code & 0x0f) << 12 | (p [0] & 0x3f) << 6 |
+                     (p [1] & 0x3f);
+                  p += 2;
+               }
+               else if (code >= 0xc0)
+               {
+                  code = (code & 0x1f) << 6 | (p [0] & 0x3f);
+                  p += 1;
+               }
+            }
+            fn (code, attrs);
+         }
+      }
+   }
+
+   void
+   Scrollback::unpack (uint64_t seq, CharVdev::Cell* dest,
+                       uint16_t nCols) const
+   {
+      uint16_t x = 0;
+      decode (seq,
+              [&] (uint16_t code, uint64_t attrs)
+              {
+                 if (x < nCols)
+                    setCell (dest [x], code, attrs);
+                 ++x;
+              });
+
+      // Pad rows stored before the terminal got wider
+      for (; x < nCols; ++x)
+         dest [x] = CharVdev::Cell ();
+   }
+
+} // namespace zutty
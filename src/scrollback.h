@@ -0,0 +1,114 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#pragma once
+
+#include "charvdev.h"
+
+#include <deque>
+#include <vector>
+
+namespace zutty
+{
+   /* Storage of the rows scrolled off the top of the screen.
+    *
+    * Rows are packed into a compact form as they are pushed (runs of
+    * cells with equal attributes, the text of each run encoded as UTF-8,
+    * just once for runs of identical cells), and appended to pages of a
+    * fixed number of rows each. The oldest rows are dropped as soon as
+    * there are more than the configured maximum.
+    *
+    * Rows are unpacked only when accessed, into a small cache, so that
+    * only rows actually viewed (or selected) ever occupy the space of
+    * full cells.
+    */
+   class Scrollback
+   {
+   public:
+      explicit Scrollback (uint32_t maxRows = 0);
+
+      uint32_t size () const { return endSeq - firstSeq; };
+      size_t getBytes () const;
+      void clear ();
+
+      // Add a row as the most recent one
+      void push (const CharVdev::Cell* row, uint16_t nCols);
+
+      // Remove the most recent row, unpacking it into dest
+      void pop (CharVdev::Cell* dest, uint16_t nCols);
+
+      /* Access the k-th most recent row (1: the latest one, up to size ())
+       * as nCols cells (cut or padded with blanks as necessary). The
+       * returned row stays valid only until a number of other rows have
+       * been accessed, or the row is popped.
+       */
+      const CharVdev::Cell* getRow (uint32_t k, uint16_t nCols) const;
+
+      // Mark the color codes used by any row (see setColorSweep)
+      void markColors (std::vector <bool>& used) const;
+
+      /* For searching: the number of rows, starting at the k-th most
+       * recent one and going towards older (or else newer) ones, that
+       * do not contain all of the given trigrams, as told by an index of
+       * the trigrams in each block of rows. Blocks are only indexed once
+       * searched for the first time, and not while still being filled.
+       */
+      uint32_t skipRows (uint32_t k, const std::vector <uint32_t>& trigrams,
+                         bool older) const;
+
+      // The hash of three successive codes (folded; see foldCase)
+      static uint32_t getTrigram (uint16_t a, uint16_t b, uint16_t c)
+      {
+         return ((a * 0x9e3779b1u) ^ (b * 0x85ebca77u) ^ (c * 0xc2b2ae3du))
+            >> 19;
+      }
+
+      // Search is not case sensitive for ASCII letters
+      static uint16_t foldCase (uint16_t code)
+      {
+         return code >= 'A' && code <= 'Z' ? code + 'a' - 'A' : code;
+      }
+
+   private:
+      constexpr const static uint32_t rowsPerPage = 256;
+      constexpr const static uint32_t cacheRows = 128;
+      constexpr const static uint32_t blockRows = 64;
+      constexpr const static uint32_t indexWords = (1 << 13) / 64;
+
+      // All pages but the last one hold rowsPerPage rows
+      struct Page
+      {
+         std::vector <uint8_t> data;
+         std::vector <uint32_t> offsets; // of each row's data
+
+         // Bit set of trigrams in each block of rows, if indexed
+         mutable std::vector <uint64_t> index;
+         mutable uint8_t indexed = 0; // bit mask of blocks
+      };
+      std::deque <Page> pages;
+      uint32_t maxRows = 0;
+      uint64_t firstSeq = 0; // sequence number of the oldest row
+      uint64_t endSeq = 0;   // sequence number of the next row pushed
+      uint64_t pagesSeq = 0; // sequence number of the first row of pages
+
+      std::vector <uint8_t> packBuf; // a row being packed
+
+      mutable std::vector <CharVdev::Cell> cache;
+      mutable std::vector <uint64_t> cacheSeq; // row in each slot, plus 1
+      mutable uint16_t cacheCols = 0;
+
+      template <typename Fn>
+      void decode (uint64_t seq, Fn&& fn) const;
+      void unpack (uint64_t seq, CharVdev::Cell* dest, uint16_t nCols) const;
+      void indexBlock (const Page& page, uint64_t seq0, uint32_t block) const;
+   };
+
+} // namespace zutty
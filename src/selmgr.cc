@@ -15,6 +15,23 @@
 
 #include <X11/Xmu/Atoms.h>
 
+#include <cstring>
+#include <memory>
+
+namespace
+{
+   std::string
+   readAll (const zutty::SelectionManager::SourceFn& source)
+   {
+      auto reader = source;
+      std::string content;
+      while (reader (content, 1 << 20))
+         ;
+      return content;
+   }
+
+} // namespace
+
 namespace zutty
 {
    SelectionManager::SelectionManager (Display* dpy_, Window win_)
@@ -31,8 +48,8 @@ namespace zutty
                    : XMaxRequestSize (dpy) >> 2)
    {
       // N.B.: create map entries:
-      ctx [primary].content = "";
-      ctx [clipboard].content = "";
+      ctx [primary].owned = false;
+      ctx [clipboard].owned = false;
 
       logT << "SelectionManager: chunkSize=" << chunkSize << std::endl;
    }
@@ -45,7 +62,7 @@ namespace zutty
 
       if (cx.owned)
       {
-         cb (true, cx.content);
+         cb (true, readAll (cx.source));
          return;
       }
 
@@ -57,23 +74,40 @@ namespace zutty
 
    bool
    SelectionManager::setSelection (Atom selection,
-                                   Time time, const std::string& content_)
+                                   Time time, SourceFn&& source)
    {
       Context& cx = ctx [selection];
 
       XSetSelectionOwner(dpy, selection, win, time);
       if (XGetSelectionOwner (dpy, selection) == win)
       {
-         cx.content = content_;
+         cx.source = std::move (source);
          cx.owned = true;
       }
       else
       {
+         cx.source = nullptr;
          cx.owned = false;
       }
       return cx.owned;
    }
 
+   bool
+   SelectionManager::setSelection (Atom selection,
+                                   Time time, const std::string& content_)
+   {
+      auto content = std::make_shared <const std::string> (content_);
+      size_t pos = 0;
+      return setSelection (selection, time,
+         [content, pos] (std::string& buf, size_t maxLen) mutable
+         {
+            size_t len = std::min (maxLen, content->size () - pos);
+            buf.append (*content, pos, len);
+            pos += len;
+            return pos < content->size ();
+         });
+   }
+
    bool
    SelectionManager::copySelection (Atom dest, Atom source)
    {
@@ -82,7 +116,9 @@ namespace zutty
       if (! cx.owned)
          return false;
 
-      return setSelection (dest, CurrentTime, cx.content);
+      // N.B.: read the content now, as the source may not stay readable
+      // for long (e.g. text selected in the terminal)
+      return setSelection (dest, CurrentTime, readAll (cx.source));
    }
 
    void
@@ -135,24 +171,28 @@ namespace zutty
    void
    SelectionManager::handleOutboundIncr (Context& cx)
    {
-      // Send next chunk of ongoing INCR transfer
-      size_t len = std::min (chunkSize, cx.content.length () - cx.cliPos);
-      if (len > 0)
+      // Send next chunk of ongoing INCR transfer (the first one has been
+      // read along with the selection request)
+      if (cx.chunk.empty () && cx.reader && !cx.reader (cx.chunk, chunkSize))
+         cx.reader = nullptr;
+
+      if (cx.chunk.size ())
       {
          logT << "Sending next INCR chunk..." << std::endl;
          XChangeProperty (dpy, cx.cliWin, cx.cliProp, target, 8, PropModeReplace,
-                          (const unsigned char *) cx.content.data () + cx.cliPos,
-                          len);
+                          (const unsigned char *) cx.chunk.data (),
+                          cx.chunk.size ());
+         cx.chunk.clear ();
       }
       else
       {
          logT << "Signaling end of INCR transfer..." << std::endl;
          XChangeProperty (dpy, cx.cliWin, cx.cliProp, target, 8, PropModeReplace,
                           nullptr, 0);
+         cx.reader = nullptr;
          cx.state = State::Idle;
       }
       XFlush (dpy);
-      cx.cliPos += len;
    }
 
    void
@@ -202,7 +242,7 @@ namespace zutty
       }
 
       ctx [event.selection].owned = false;
-      ctx [event.selection].content = "";
+      ctx [event.selection].source = nullptr;
    }
 
    void
@@ -308,7 +348,6 @@ namespace zutty
 
       cx.cliWin = event.requestor;
       cx.cliProp = event.property;
-      cx.cliPos = 0;
 
       if (event.target == targets) // response to TARGETS request
       {
@@ -316,21 +355,29 @@ namespace zutty
          XChangeProperty (dpy, cx.cliWin, cx.cliProp, XA_ATOM, 32,
                           PropModeReplace, (const unsigned char *) types, 2);
       }
-      else if (chunkSize < cx.content.size ()) // INCR response
-      {
-         logT << "Sending INCR response" << std::endl;
-         XChangeProperty (dpy, cx.cliWin, cx.cliProp, incr, 32,
-                          PropModeReplace, nullptr, 0);
-         XSelectInput (dpy, cx.cliWin, PropertyChangeMask);
-         cx.state = State::WaitingForIncrAck;
-      }
-      else // normal response (send all data)
+      else
       {
-         logT << "Sending normal response" << std::endl;
-         XChangeProperty (dpy, cx.cliWin, cx.cliProp, target, 8,
-                          PropModeReplace,
-                          (const unsigned char *) cx.content.data (),
-                          cx.content.size ());
+         // Read the first chunk to know if the content fits into one
+         cx.reader = cx.source;
+         cx.chunk.clear ();
+         if (cx.reader (cx.chunk, chunkSize)) // INCR response
+         {
+            logT << "Sending INCR response" << std::endl;
+            XChangeProperty (dpy, cx.cliWin, cx.cliProp, incr, 32,
+                             PropModeReplace, nullptr, 0);
+            XSelectInput (dpy, cx.cliWin, PropertyChangeMask);
+            cx.state = State::WaitingForIncrAck;
+         }
+         else // normal response (send all data)
+         {
+            logT << "Sending normal response" << std::endl;
+            XChangeProperty (dpy, cx.cliWin, cx.cliProp, target, 8,
+                             PropModeReplace,
+                             (const unsigned char *) cx.chunk.data (),
+                             cx.chunk.size ());
+            cx.reader = nullptr;
+            cx.chunk.clear ();
+         }
       }
 
       // send SelectionNotify event in response
@@ -32,6 +32,15 @@ namespace zutty
 
       using PasteCallbackFn = std::function <void (bool, const std::string&)>;
       void getSelection (Atom selection, Time, PasteCallbackFn&&);
+
+      /* Content of an owned selection, read in chunks on demand so that
+       * it need not be kept as a whole: each call appends at most maxLen
+       * bytes to buf, and returns false once the end is reached. The
+       * source passed is only read through copies of it, each of these
+       * starting from the beginning of the content.
+       */
+      using SourceFn = std::function <bool (std::string& buf, size_t maxLen)>;
+      bool setSelection (Atom selection, const Time, SourceFn&&);
       bool setSelection (Atom selection, const Time, const std::string&);
       bool copySelection (Atom dest, Atom source);
 
@@ -64,7 +73,7 @@ namespace zutty
       struct Context
       {
          bool owned = false;
-         std::string content;
+         SourceFn source;
          PasteCallbackFn pasteCallback;
          State state = State::Idle;
 
@@ -72,7 +81,8 @@ namespace zutty
          std::vector <unsigned char> incoming;
 
          // outbound transfer state
-         size_t cliPos;
+         SourceFn reader;
+         std::string chunk;
          Window cliWin;
          Atom cliProp;
       };
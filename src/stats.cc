@@ -0,0 +1,123 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+   // Average of a time in ns per count, in ms
+   double
+   avgMs (uint64_t ns, uint64_t count)
+   {
+      return count ? ns / 1e6 / count : 0.0;
+   }
+
+   // Set before main () runs, which is as close to the start of the
+   // process as it gets
+   std::chrono::steady_clock::time_point startTime =
+      std::chrono::steady_clock::now ();
+
+} // namespace
+
+namespace zutty
+{
+   namespace stats
+   {
+      std::atomic <uint64_t> counters [NumCounters];
+
+      void
+      mark (Counter c)
+      {
+         if (counters [c].load (std::memory_order_relaxed))
+            return;
+
+         uint64_t unset = 0;
+         counters [c].compare_exchange_strong (unset,
+                                               std::max (nsSince (startTime),
+                                                         (uint64_t) 1),
+                                               std::memory_order_relaxed);
+      }
+
+      void
+      restart ()
+      {
+         startTime = std::chrono::steady_clock::now ();
+      }
+
+      Sample
+      sample ()
+      {
+         Sample ret;
+         for (int c = 0; c < NumCounters; ++c)
+            ret [c] = counters [c].load (std::memory_order_relaxed);
+         return ret;
+      }
+
+      std::string
+      formatHud (const Sample& prev, const Sample& cur, double secs)
+      {
+         Sample d;
+         for (int c = 0; c < NumCounters; ++c)
+            d [c] = cur [c] - prev [c];
+
+         std::ostringstream oss;
+         oss << std::fixed << std::setprecision (1)
+             << " pty " << d [PtyBytes] / secs / 1e6 << " MB/s "
+             << std::setprecision (0)
+             << d [InputNs] / secs / 1e7 << "% | "
+             << d [FramesDrawn] / secs << " fps "
+             << d [FramesSkipped] / secs << " skip "
+             << d [FullFrames] / secs << " full | "
+             << std::setprecision (2);
+         if (d [GpuTimed])
+            oss << "gpu " << avgMs (d [ComputeGpuNs], d [GpuTimed])
+                << '+' << avgMs (d [DrawGpuNs], d [GpuTimed]) << " ms | ";
+         oss << "swap " << avgMs (d [SwapNs], d [FramesDrawn]) << " ms ";
+         return oss.str ();
+      }
+
+      void
+      print (std::ostream& os)
+      {
+         const Sample s = sample ();
+         os << std::fixed << std::setprecision (3)
+            << "pty bytes read:       " << s [PtyBytes] << "\n"
+            << "input processing:     " << s [InputNs] / 1e6 << " ms";
+         if (s [InputNs])
+            os << " (" << s [PtyBytes] * 1e3 / s [InputNs] << " MB/s)";
+         os << "\n"
+            << "frames drawn:         " << s [FramesDrawn] << "\n"
+            << "frames skipped:       " << s [FramesSkipped] << "\n"
+            << "delta / full uploads: " << s [DeltaFrames]
+            << " / " << s [FullFrames] << "\n";
+         if (s [GpuTimed])
+            os << "gpu compute / draw:   "
+               << avgMs (s [ComputeGpuNs], s [GpuTimed]) << " / "
+               << avgMs (s [DrawGpuNs], s [GpuTimed]) << " ms per frame "
+               << "(" << s [GpuTimed] << " frames timed)\n";
+         else
+            os << "gpu compute / draw:   not measured\n";
+         os << "buffer swap:          "
+            << avgMs (s [SwapNs], s [FramesDrawn]) << " ms per frame\n"
+            << "startup phases (ms):  fonts " << s [FontsReadyNs] / 1e6
+            << " / window " << s [WindowReadyNs] / 1e6
+            << " / shell " << s [ShellForkNs] / 1e6
+            << " / gl " << s [GlReadyNs] / 1e6
+            << " / first frame " << s [FirstFrameNs] / 1e6
+            << std::endl;
+      }
+   }
+
+} // namespace zutty
@@ -0,0 +1,89 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace zutty
+{
+   /* Counters of the work done along the way from pty input to the
+    * screen, telling where the time goes under load: parsing, copying
+    * frames, the GPU or the compositor (swap). They are counted by both
+    * the pty thread and the render thread, and shown on screen with
+    * -hud, or printed on exit with -stats.
+    */
+   namespace stats
+   {
+      enum Counter
+      {
+         PtyBytes,      // bytes read from the pty
+         InputNs,       // time spent processing them
+         FramesDrawn,   // frames drawn and swapped to the screen
+         FramesSkipped, // frames not drawn, a newer one being ready
+         DeltaFrames,   // frames uploaded as changes to the last one
+         FullFrames,    // frames uploaded in full
+         GpuTimed,      // frames whose GPU time below got measured
+         ComputeGpuNs,  // GPU time of the compute shader
+         DrawGpuNs,     // GPU time of drawing the output to the window
+         SwapNs,        // time spent swapping buffers
+
+         // Startup phases, as marks in ns since the start (see mark)
+         FontsReadyNs,  // fonts loaded
+         WindowReadyNs, // X window and EGL surface created
+         ShellForkNs,   // shell process started
+         GlReadyNs,     // render thread set up (shaders, atlas, buffers)
+         FirstFrameNs,  // first frame swapped to the screen
+         NumCounters
+      };
+
+      using Sample = std::array <uint64_t, NumCounters>;
+
+      extern std::atomic <uint64_t> counters [NumCounters];
+
+      inline void
+      add (Counter c, uint64_t n)
+      {
+         counters [c].fetch_add (n, std::memory_order_relaxed);
+      }
+
+      inline uint64_t
+      nsSince (std::chrono::steady_clock::time_point t0)
+      {
+         using namespace std::chrono;
+         return duration_cast <nanoseconds> (steady_clock::now () - t0)
+            .count ();
+      }
+
+      // Set the mark c to the time since the start of the process (or of
+      // the window, when forked by the daemon), unless it is set already
+      void mark (Counter c);
+
+      // Take the start of the times marked to be now
+      void restart ();
+
+      Sample sample ();
+
+      // One line of rates and averages over the interval between two
+      // samples taken secs apart, for the on-screen display
+      std::string formatHud (const Sample& prev, const Sample& cur,
+                             double secs);
+
+      // The totals (and averages) of counts since startup
+      void print (std::ostream& os);
+   }
+
+} // namespace zutty
@@ -0,0 +1,56 @@
+/* This file is part of Zutty.
+ * Copyright (C) 2020 Tom Szilagyi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE for the full license.
+ */
+
+#include "utf8.h"
+
+#include <unordered_map>
+
+namespace
+{
+   using namespace zutty;
+
+   // Entries are only ever appended, and are published to the render
+   // thread along with the cells referring to them, so reading them
+   // needs no further synchronization.
+   uint32_t astralCodepoints [Astral_Code_Count];
+   std::unordered_map <uint32_t, uint16_t> astralCodes;
+
+} // namespace
+
+namespace zutty
+{
+   uint16_t
+   internCodepoint (uint32_t cp)
+   {
+      if (cp < 0x10000)
+         return isAstralCode (cp) ? Unicode_Replacement_Character : cp;
+
+      const auto it = astralCodes.find (cp);
+      if (it != astralCodes.end ())
+         return it->second;
+
+      const uint16_t n = astralCodes.size ();
+      if (n == Astral_Code_Count)
+         return Missing_Glyph_Marker;
+
+      astralCodepoints [n] = cp;
+      return astralCodes [cp] = Astral_Code_Base + n;
+   }
+
+   uint32_t
+   resolveCode (uint16_t code)
+   {
+      if (isAstralCode (code))
+         return astralCodepoints [code - Astral_Code_Base];
+      return code;
+   }
+
+} // namespace zutty
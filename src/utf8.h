@@ -11,8 +11,15 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
-#include <functional>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 namespace zutty
 {
@@ -21,6 +28,86 @@ namespace zutty
    // The "question mark" to display in place of invalid/unsupported unicode
    constexpr const uint16_t Unicode_Replacement_Character = 0xfffd;
 
+   /* Code points beyond the Basic Multilingual Plane do not fit into the
+    * 16-bit code of a cell. These are interned into the range of UTF-16
+    * surrogates (which are never characters on their own), and resolved
+    * back to the actual code point where that is needed (glyph lookup,
+    * conversion to UTF-8). The codes are kept for the lifetime of the
+    * program; when they run out, the missing glyph marker is returned.
+    */
+   constexpr const uint16_t Astral_Code_Base = 0xd800;
+   constexpr const uint16_t Astral_Code_Count = 0x800;
+
+   inline bool
+   isAstralCode (uint32_t code)
+   {
+      return code >= Astral_Code_Base &&
+         code < Astral_Code_Base + Astral_Code_Count;
+   }
+
+   // Return the cell code of a code point; to be called only from the
+   // thread processing terminal input.
+   uint16_t internCodepoint (uint32_t cp);
+
+   // Return the code point of a cell code (the inverse of the above)
+   uint32_t resolveCode (uint16_t code);
+
+   // Return the length of the run of printable ASCII characters (0x20 to
+   // 0x7e) at the start of [begin, end). Each of these bytes decodes to a
+   // single-width code point equal to its own value, so such runs may be
+   // placed directly, without going through the decoder byte by byte.
+   inline size_t
+   printableAsciiRun (const unsigned char* begin, const unsigned char* end)
+   {
+      const unsigned char* p = begin;
+
+      // N.B.: bytes with the high bit set are negative as signed chars,
+      // so a signed compare rejects them along with C0 controls and DEL.
+#if defined(__AVX2__)
+      const __m256i lo32 = _mm256_set1_epi8 (0x1f);
+      const __m256i hi32 = _mm256_set1_epi8 (0x7f);
+      while (end - p >= 32)
+      {
+         const __m256i v = _mm256_loadu_si256 ((const __m256i*) p);
+         const __m256i ok = _mm256_and_si256 (_mm256_cmpgt_epi8 (v, lo32),
+                                              _mm256_cmpgt_epi8 (hi32, v));
+         const uint32_t stop = ~(uint32_t) _mm256_movemask_epi8 (ok);
+         if (stop)
+            return p - begin + __builtin_ctz (stop);
+         p += 32;
+      }
+#endif
+#if defined(__SSE2__)
+      const __m128i lo16 = _mm_set1_epi8 (0x1f);
+      const __m128i hi16 = _mm_set1_epi8 (0x7f);
+      while (end - p >= 16)
+      {
+         const __m128i v = _mm_loadu_si128 ((const __m128i*) p);
+         const __m128i ok = _mm_and_si128 (_mm_cmpgt_epi8 (v, lo16),
+                                           _mm_cmplt_epi8 (v, hi16));
+         const uint32_t stop = ~_mm_movemask_epi8 (ok) & 0xffff;
+         if (stop)
+            return p - begin + __builtin_ctz (stop);
+         p += 16;
+      }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+      const uint8x16_t lo16 = vdupq_n_u8 (0x1f);
+      const uint8x16_t hi16 = vdupq_n_u8 (0x7f);
+      while (end - p >= 16)
+      {
+         const uint8x16_t v = vld1q_u8 (p);
+         const uint8x16_t ok = vandq_u8 (vcgtq_u8 (v, lo16),
+                                         vcltq_u8 (v, hi16));
+         if (vminvq_u8 (ok) != 0xff)
+            break; // locate the stop byte below
+         p += 16;
+      }
+#endif
+      while (p < end && *p >= 0x20 && *p < 0x7f)
+         ++p;
+      return p - begin;
+   }
+
    struct Utf8Encoder
    {
       template <typename Fn>
@@ -52,12 +139,14 @@ namespace zutty
       }
    };
 
+   // CodepointSink is called with each decoded code point. It is a template
+   // parameter (instead of a std::function) so that it can be inlined into
+   // the input processing loop of the caller.
+   template <typename CodepointSink>
    class Utf8Decoder
    {
    public:
-      using CodepointSink = std::function <void ()>;
-
-      Utf8Decoder (CodepointSink&& fn): cpSink (fn) {}
+      Utf8Decoder (CodepointSink&& fn): cpSink (std::move (fn)) {}
 
       void checkPrematureEOS ()
       {
@@ -66,7 +155,7 @@ namespace zutty
             remaining = 0;
             valid = false;
             unicode = Unicode_Replacement_Character;
-            cpSink ();
+            cpSink (unicode);
          }
       }
 
@@ -87,7 +176,7 @@ namespace zutty
 
          unicode = ch;
          valid = true;
-         cpSink ();
+         cpSink (unicode);
       }
 
       void pushByte (unsigned char ch)
@@ -110,7 +199,7 @@ namespace zutty
             {
                if (!valid)
                   unicode = Unicode_Replacement_Character;
-               cpSink ();
+               cpSink (unicode);
             }
          }
          else if ((ch >> 5) == 0x6) // 110x'xxxx
@@ -154,7 +243,7 @@ namespace zutty
             unicode = Unicode_Replacement_Character;
             remaining = 0;
             valid = false;
-            cpSink ();
+            cpSink (unicode);
          }
       }
 
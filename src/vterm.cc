@@ -11,6 +11,7 @@
 
 #include "options.h"
 #include "pty.h"
+#include "record.h"
 #include "vterm.h"
 
 #include <cstring>
@@ -21,6 +22,13 @@ namespace
    using Key = VtKey;
    using InputSpec = Vterm::InputSpec;
 
+   // Queued output is appended to the last chunk until it reaches this size
+   constexpr const size_t Output_Chunk_Size = 64 * 1024;
+
+   // New pastes are refused while this much output is still queued, so a
+   // child that has stopped reading does not make the queue grow unbounded.
+   constexpr const size_t Max_Pending_Paste = 16 * 1024 * 1024;
+
    #define ESC "\x1b"
    #define CSI ESC "["
    #define SS3 ESC "O"
@@ -575,6 +583,8 @@ namespace zutty
       uc_IsoUK
    };
 
+   constexpr const std::chrono::milliseconds::rep Vterm::syncUpdateTimeout;
+
    Vterm::Vterm (uint16_t glyphPx_, uint16_t glyphPy_,
                  uint16_t winPx_, uint16_t winPy_,
                  int ptyFd_)
@@ -591,7 +601,7 @@ namespace zutty
       , frame_pri (winPx, winPy, nCols, nRows, marginTop, marginBottom,
                    opts.saveLines)
       , cf (&frame_pri)
-      , utf8dec ([this] () { placeGraphicChar (); })
+      , utf8dec (GraphicCharSink {this})
       , nColsEff (nCols)
       , hMargin (0)
    {
@@ -603,6 +613,28 @@ namespace zutty
       bgPalIx = defaultBgPalIx;
 
       resetTerminal ();
+
+      setColorSweep ([this] (std::vector <bool>& used)
+                     { markColors (used); });
+   }
+
+   Vterm::~Vterm ()
+   {
+      setColorSweep (nullptr);
+   }
+
+   void
+   Vterm::markColors (std::vector <bool>& used) const
+   {
+      // When called from internAttrColors (), attrs.fg is updated already
+      for (const auto* cell: {&attrs, &savedCursor_DEC_pri.attrs,
+                              &savedCursor_DEC_alt.attrs})
+      {
+         used [cell->fg] = true;
+         used [cell->bg] = true;
+      }
+      frame_pri.markColors (used);
+      frame_alt.markColors (used);
    }
 
    void
@@ -634,32 +666,21 @@ namespace zutty
          return;
       }
 
+      record::resize (nCols_, nRows_);
       hideCursor ();
 
+      bool lastCol_ = false;
       if (altScreenBufferMode)
       {
+         frame_alt.freeCells (); // saving any text selected from it
          frame_alt = Frame (winPx, winPy, nCols_, nRows_,
                             marginTop, marginBottom);
       }
       else
       {
-         if (nRows_ < posY + 1)
-         {
-            int nScroll = nRows - nRows_;
-            cf->scrollUp (nScroll);
-            posY -= nScroll;
-         }
-
+         lastCol_ = lastCol;
          frame_pri.resize (winPx, winPy, nCols_, nRows_,
-                           marginTop, marginBottom);
-
-         if (nRows < nRows_)
-         {
-            int nScroll = std::min (nRows_ - nRows, (int)cf->getHistoryRows ());
-            cf->scrollDown (nScroll);
-            posY += nScroll;
-         }
-
+                           marginTop, marginBottom, posY, posX, lastCol_);
          frame_alt.freeCells ();
       }
       nCols = nCols_;
@@ -676,6 +697,7 @@ namespace zutty
          hMargin = 0;
       }
       normalizeCursorPos ();
+      lastCol = lastCol_ && posX == nColsEff - 1;
       showCursor ();
 
       pty_resize (ptyFd, nCols, nRows);
@@ -818,7 +840,72 @@ namespace zutty
       logT << "pty write: " << dumpBuffer (ucstr, ucstr + len);
       if (userInput && localEcho)
          processInput (getLocalEcho (ucstr, ucstr + len));
-      return write (ptyFd, ucstr, len);
+      return queueOutput (ucstr, len);
+   }
+
+   int
+   Vterm::queueOutput (const uint8_t* ucstr, size_t len)
+   {
+      // Write directly only if there is nothing queued ahead of this data
+      size_t n = 0;
+      if (outputQueue.empty ())
+      {
+         ssize_t ret = write (ptyFd, ucstr, len);
+         if (ret < 0 && errno != EAGAIN && errno != EINTR)
+            return ret;
+         n = std::max (ret, (ssize_t) 0);
+      }
+
+      if (n < len)
+      {
+         if (outputQueue.empty () ||
+             outputQueue.back ().size () >= Output_Chunk_Size)
+            outputQueue.emplace_back ();
+         outputQueue.back ().append ((const char*) ucstr + n, len - n);
+         outputPending += len - n;
+         logT << "pty write: queued " << len - n << " bytes, "
+              << outputPending << " pending" << std::endl;
+      }
+      return len;
+   }
+
+   bool
+   Vterm::hasPendingOutput () const
+   {
+      return outputPending > 0;
+   }
+
+   void
+   Vterm::flushOutput ()
+   {
+      while (!outputQueue.empty ())
+      {
+         const std::string& chunk = outputQueue.front ();
+         ssize_t n = write (ptyFd, chunk.data () + outputHead,
+                            chunk.size () - outputHead);
+         if (n < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            if (errno != EAGAIN)
+            {
+               logW << "pty write failed, discarding " << outputPending
+                    << " bytes of pending output" << std::endl;
+               outputQueue.clear ();
+               outputHead = 0;
+               outputPending = 0;
+            }
+            return;
+         }
+
+         outputHead += n;
+         outputPending -= n;
+         if (outputHead == chunk.size ())
+         {
+            outputQueue.pop_front ();
+            outputHead = 0;
+         }
+      }
    }
 
    using Key = VtKey;
@@ -963,30 +1050,452 @@ namespace zutty
       return nullSpec;
    }
 
-#define COLLECT_NUMERIC_PARAMS                                        \
-   case '0': case '1': case '2': case '3': case '4':                  \
-   case '5': case '6': case '7': case '8': case '9':                  \
-      if (inputOps [nInputOps - 1] < 429496704)                       \
-      {                                                               \
-         inputOps [nInputOps - 1] *= 10;                              \
-         inputOps [nInputOps - 1] += ch - '0';                        \
-      }                                                               \
-      else                                                            \
-      {                                                               \
-         logE << "inputOp overflow!" << std::endl;                    \
-         setState (InputState::Normal);                               \
-      }                                                               \
-      break;                                                          \
-   case ';':                                                          \
-      if (nInputOps < maxEscOps)                                      \
-         inputOps [nInputOps ++] = 0;                                 \
-      else                                                            \
-      {                                                               \
-         logE << "inputOps full, increase maxEscOps (currently: "     \
-              << maxEscOps << ")!" << std::endl;                      \
-         setState (InputState::Normal);                               \
-      }                                                               \
-      break
+   constexpr Vterm::ByteClasses
+   Vterm::makeByteClasses ()
+   {
+      ByteClasses bc {};
+      for (int ch = 0; ch < 256; ++ch)
+      {
+         if (ch < 0x20)
+            bc.of [ch] = ByteClass::Control;
+         else if (ch < 0x30)
+            bc.of [ch] = ByteClass::Intermediate;
+         else if (ch <= '9' || ch == ';')
+            bc.of [ch] = ByteClass::Param;
+         else if (ch == ':')
+            bc.of [ch] = ByteClass::Colon;
+         else if (ch < 0x40)
+            bc.of [ch] = ByteClass::Private;
+         else if (ch < 0x7f)
+            bc.of [ch] = ByteClass::Final;
+         else if (ch == 0x7f)
+            bc.of [ch] = ByteClass::Delete;
+         else
+            bc.of [ch] = ByteClass::High;
+      }
+      bc.of [0x18] = bc.of [0x1a] = ByteClass::Cancel;
+      bc.of [0x1b] = ByteClass::Escape;
+      bc.of [0x07] = ByteClass::Bell;
+      bc.of [0x08] = ByteClass::Backspace;
+      bc.of [0x09] = bc.of [0x0b] = bc.of [0x0c] = bc.of [0x0d] =
+         ByteClass::Format;
+      return bc;
+   }
+
+   // Set the transitions of state for all byte classes
+   constexpr void
+   Vterm::setTransitions (InputTransitions& t, InputState state,
+                          InputAction action, InputState next)
+   {
+      for (int c = 0; c < nByteClasses; ++c)
+         t.at [(int) state][c] = {action, next};
+   }
+
+   constexpr void
+   Vterm::setTransition (InputTransitions& t, InputState state,
+                         ByteClass cls, InputAction action, InputState next)
+   {
+      t.at [(int) state][(int) cls] = {action, next};
+   }
+
+   // N.B.: Normal input is not parsed via this table, as most of it goes
+   // straight to the screen, in runs of printable characters.
+   constexpr Vterm::InputTransitions
+   Vterm::makeInputTransitions ()
+   {
+      using S = InputState;
+      using C = ByteClass;
+      using A = InputAction;
+
+      InputTransitions t {};
+      for (S s: {S::Escape, S::Escape_VT52})
+      {
+         setTransitions (t, s, A::Dispatch, s);
+         setTransition (t, s, C::Cancel, A::Enter, S::Normal);
+         setTransition (t, s, C::Escape, A::Restart, s);
+      }
+
+      for (S s: {S::Esc_SPC, S::Esc_Pct, S::CSI_Quote, S::CSI_DblQuote,
+                 S::CSI_Bang, S::CSI_SPC, S::CSI_GT, S::CSI_priv})
+      {
+         setTransitions (t, s, A::Unhandled, s);
+         setTransition (t, s, C::Final, A::Dispatch, s);
+      }
+      setTransitions (t, S::Esc_Hash, A::Unhandled, S::Esc_Hash);
+      setTransition (t, S::Esc_Hash, C::Param, A::Dispatch, S::Esc_Hash);
+
+      setTransitions (t, S::SelectCharset, A::Dispatch, S::SelectCharset);
+      for (C c: {C::Control, C::Cancel, C::Escape, C::Bell, C::Backspace,
+                 C::Format, C::Intermediate})
+         setTransition (t, S::SelectCharset, c, A::Collect, S::SelectCharset);
+
+      setTransitions (t, S::CSI, A::Unhandled, S::CSI);
+      setTransition (t, S::CSI, C::Escape, A::Enter, S::Normal);
+      setTransition (t, S::CSI, C::Bell, A::Ignore, S::CSI);
+      setTransition (t, S::CSI, C::Backspace, A::Undo, S::CSI);
+      setTransition (t, S::CSI, C::Format, A::Execute, S::CSI);
+      setTransition (t, S::CSI, C::Intermediate, A::Dispatch, S::CSI);
+      setTransition (t, S::CSI, C::Param, A::Param, S::CSI);
+      setTransition (t, S::CSI, C::Private, A::Dispatch, S::CSI);
+      setTransition (t, S::CSI, C::Final, A::CsiDispatch, S::CSI);
+
+      setTransition (t, S::CSI_priv, C::Escape, A::Enter, S::Normal);
+      setTransition (t, S::CSI_priv, C::Param, A::Param, S::CSI_priv);
+      setTransition (t, S::CSI_GT, C::Param, A::Param, S::CSI_GT);
+
+      setTransitions (t, S::DCS, A::Put, S::DCS);
+      setTransition (t, S::DCS, C::Escape, A::Enter, S::DCS_Esc);
+      setTransitions (t, S::OSC, A::Put, S::OSC);
+      setTransition (t, S::OSC, C::Escape, A::Enter, S::OSC_Esc);
+      setTransition (t, S::OSC, C::Bell, A::Dispatch, S::OSC);
+
+      for (S s: {S::DCS_Esc, S::OSC_Esc, S::VT52_CUP_Arg1, S::VT52_CUP_Arg2})
+         setTransitions (t, s, A::Dispatch, s);
+      return t;
+   }
+
+   constexpr Vterm::InputTable
+   Vterm::makeInputTable ()
+   {
+      const ByteClasses bc = makeByteClasses ();
+      const InputTransitions t = makeInputTransitions ();
+      InputTable table {};
+      for (int s = 0; s < nInputStates; ++s)
+         for (int ch = 0; ch < 256; ++ch)
+            table.at [s][ch] = t.at [s][(int) bc.of [ch]];
+      return table;
+   }
+
+   constexpr const Vterm::InputTable Vterm::inputTable =
+      Vterm::makeInputTable ();
+
+   // Dispatch table for the final byte of CSI sequences without private
+   // marker or intermediates, indexed by (final byte - '@').
+   const Vterm::CsiHandlerFn Vterm::csiHandlers [] =
+   {
+      &Vterm::csi_ICH,             // '@'
+      &Vterm::csi_CUU,             // 'A'
+      &Vterm::csi_CUD,             // 'B'
+      &Vterm::csi_CUF,             // 'C'
+      &Vterm::csi_CUB,             // 'D'
+      &Vterm::csi_CNL,             // 'E'
+      &Vterm::csi_CPL,             // 'F'
+      &Vterm::csi_CHA,             // 'G'
+      &Vterm::csi_CUP,             // 'H'
+      &Vterm::csi_CHT,             // 'I'
+      &Vterm::csi_ED,              // 'J'
+      &Vterm::csi_EL,              // 'K'
+      &Vterm::csi_IL,              // 'L'
+      &Vterm::csi_DL,              // 'M'
+      nullptr,                     // 'N'
+      nullptr,                     // 'O'
+      &Vterm::csi_DCH,             // 'P'
+      nullptr,                     // 'Q'
+      nullptr,                     // 'R'
+      &Vterm::csi_SU,              // 'S'
+      &Vterm::csi_SD,              // 'T'
+      nullptr,                     // 'U'
+      nullptr,                     // 'V'
+      nullptr,                     // 'W'
+      &Vterm::csi_ECH,             // 'X'
+      nullptr,                     // 'Y'
+      &Vterm::csi_CBT,             // 'Z'
+      nullptr,                     // '['
+      nullptr,                     // '\\'
+      nullptr,                     // ']'
+      nullptr,                     // '^'
+      nullptr,                     // '_'
+      &Vterm::csi_HPA,             // '`'
+      &Vterm::csi_HPR,             // 'a'
+      &Vterm::csi_REP,             // 'b'
+      &Vterm::csi_priDA,           // 'c'
+      &Vterm::csi_VPA,             // 'd'
+      &Vterm::csi_VPR,             // 'e'
+      &Vterm::csi_CUP,             // 'f'
+      &Vterm::csi_TBC,             // 'g'
+      &Vterm::csi_SM,              // 'h'
+      nullptr,                     // 'i'
+      nullptr,                     // 'j'
+      nullptr,                     // 'k'
+      &Vterm::csi_RM,              // 'l'
+      &Vterm::csi_SGR,             // 'm'
+      &Vterm::csi_DSR,             // 'n'
+      nullptr,                     // 'o'
+      nullptr,                     // 'p'
+      nullptr,                     // 'q'
+      &Vterm::csi_STBM,            // 'r'
+      &Vterm::csi_SCOSC_SLRM,      // 's'
+      &Vterm::csi_XTWINOPS,        // 't'
+      &Vterm::csi_SCORC,           // 'u'
+      nullptr,                     // 'v'
+      nullptr,                     // 'w'
+      nullptr,                     // 'x'
+      nullptr,                     // 'y'
+      nullptr,                     // 'z'
+      nullptr,                     // '{'
+      nullptr,                     // '|'
+      nullptr,                     // '}'
+      nullptr,                     // '~'
+   };
+
+   // Act on a byte with a meaning particular to the input state
+   void
+   Vterm::dispatchInput (unsigned char ch)
+   {
+      switch (inputState)
+      {
+      case InputState::Escape_VT52:
+         switch (ch)
+         {
+         case '=':
+            keypadMode = KeypadMode::Application;
+            setState (InputState::Normal);
+            break;
+         case '>':
+            keypadMode = KeypadMode::Normal;
+            setState (InputState::Normal);
+            break;
+         case '<':
+            compatLevel = CompatibilityLevel::VT100;
+            setState (InputState::Normal);
+            break;
+         case 'A': csi_CUU (); break;
+         case 'B': csi_CUD (); break;
+         case 'C': csi_CUF (); break;
+         case 'D': csi_CUB (); break;
+         case 'F':
+            charsetState = CharsetState {};
+            charsetState.g [charsetState.gl] = Charset::DecSpec;
+            setState (InputState::Normal);
+            break;
+         case 'G':
+            charsetState = CharsetState {};
+            setState (InputState::Normal);
+            break;
+         case 'H': csi_CUP (); break;
+         case 'I': esc_RI (); break;
+         case 'J': csi_ED (); break;
+         case 'K': csi_EL (); break;
+         case 'Y': setState (InputState::VT52_CUP_Arg1); break;
+         case 'Z': writePty ("\e/Z"); break;
+         case 'c': esc_RIS (); break; // allow "reset" command to escape VT52
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::VT52_CUP_Arg1:
+         inputOps [0] = ch - 31;
+         setState (InputState::VT52_CUP_Arg2);
+         break;
+      case InputState::VT52_CUP_Arg2:
+         inputOps [1] = ch - 31;
+         nInputOps = 2;
+         csi_CUP ();
+         break;
+      case InputState::Escape:
+         switch (ch)
+         {
+         case ' ': setState (InputState::Esc_SPC); break;
+         case '#': setState (InputState::Esc_Hash); break;
+         case '%': setState (InputState::Esc_Pct); break;
+         case '[': setState (InputState::CSI); break;
+         case ']': argBuf.clear (); setState (InputState::OSC); break;
+         case '(': case ')': case '*': case '+':
+         case '-': case '.': case '/':
+         case ',': case '$': // from ISO/IEC 2022 (absorbed, treat as no-op)
+            scsDst = ch;
+            scsMod = '\0';
+            setState (InputState::SelectCharset);
+            break;
+         case 'D': esc_IND (); break;
+         case 'M': esc_RI (); break;
+         case 'E': esc_NEL (); break;
+         case 'H': esc_HTS (); break;
+         case 'N': charsetState.ss = 2; setState (InputState::Normal); break;
+         case 'O': charsetState.ss = 3; setState (InputState::Normal); break;
+         case 'P': argBuf.clear (); setState (InputState::DCS); break;
+         case 'c': esc_RIS (); break;
+         case '6': esc_BI (); break;
+         case '7': esc_DECSC (); break;
+         case '8': esc_DECRC (); break;
+         case '9': esc_FI (); break;
+         case '=':
+            keypadMode = KeypadMode::Application;
+            setState (InputState::Normal);
+            break;
+         case '>':
+            keypadMode = KeypadMode::Normal;
+            setState (InputState::Normal);
+            break;
+         case '<':
+            compatLevel = CompatibilityLevel::VT400;
+            setState (InputState::Normal);
+            break;
+         case '~': charsetState.gr = 1; setState (InputState::Normal); break;
+         case 'n': charsetState.gl = 2; setState (InputState::Normal); break;
+         case '}': charsetState.gr = 2; setState (InputState::Normal); break;
+         case 'o': charsetState.gl = 3; setState (InputState::Normal); break;
+         case '|': charsetState.gr = 3; setState (InputState::Normal); break;
+         case '\\': setState (InputState::Normal); break; // ignore lone ST
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::Esc_SPC:
+         switch (ch)
+         {
+         case 'F':
+            logU << "S7C1T: Send 7-bit controls" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case 'G':
+            logU << "S8C1T: Send 8-bit controls" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case 'L':
+            logU << "Set ANSI conformance level 1" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case 'M':
+            logU << "Set ANSI conformance level 2" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case 'N':
+            logU << "Set ANSI conformance level 3" << std::endl;
+            setState (InputState::Normal);
+            break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::Esc_Hash:
+         switch (ch)
+         {
+         case '3':
+            logU << "DECDHL: Double-height, top half" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case '4':
+            logU << "DECDHL: Double-height, bottom half" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case '5':
+            logU << "DECSWL: Single-width line" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case '6':
+            logU << "DECDWL: Double-width line" << std::endl;
+            setState (InputState::Normal);
+            break;
+         case '8': esch_DECALN (); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::Esc_Pct:
+         switch (ch)
+         {
+         case '@':
+            logT << "Select charset: default (ISO-8859-1)" << std::endl;
+            charsetState = CharsetState {};
+            charsetState.g [charsetState.gr] = Charset::IsoLatin1;
+            setState (InputState::Normal);
+            break;
+         case 'G':
+            logT << "Select charset: UTF-8" << std::endl;
+            charsetState = CharsetState {};
+            setState (InputState::Normal);
+            break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::SelectCharset:
+         esc_DCS (ch);
+         break;
+      case InputState::CSI: // intermediates and private markers
+         switch (ch)
+         {
+         case '\'': setState (InputState::CSI_Quote); break;
+         case '\"': setState (InputState::CSI_DblQuote); break;
+         case '!': setState (InputState::CSI_Bang); break;
+         case '?': setState (InputState::CSI_priv); break;
+         case ' ': setState (InputState::CSI_SPC); break;
+         case '>': setState (InputState::CSI_GT); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::CSI_Bang:
+         switch (ch)
+         {
+         case 'p': csi_DECSTR (); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::CSI_Quote:
+         switch (ch)
+         {
+         case '}': csi_DECIC (); break;
+         case '~': csi_DECDC (); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::CSI_DblQuote:
+         switch (ch)
+         {
+         case 'p': csiq_DECSCL (); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::CSI_SPC:
+         switch (ch)
+         {
+         case '@': csi_ecma48_SL (); break;
+         case 'A': csi_ecma48_SR (); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::CSI_GT:
+         switch (ch)
+         {
+         case 'c': csi_secDA (); break;
+         case 'm': csi_XTMODKEYS (); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::CSI_priv:
+         switch (ch)
+         {
+         case 'h': csi_privSM (); break;
+         case 'l': csi_privRM (); break;
+         default: unhandledInput (ch); break;
+         }
+         break;
+      case InputState::DCS_Esc:
+         switch (ch)
+         {
+         case '\\': handle_DCS (); break;
+         default:
+            argBuf.push_back ('\e');
+            argBuf.push_back (ch);
+            setState (InputState::DCS);
+            break;
+         }
+         break;
+      case InputState::OSC: // terminated by BEL
+         handle_OSC ();
+         break;
+      case InputState::OSC_Esc:
+         switch (ch)
+         {
+         case '\\': handle_OSC (); break;
+         default:
+            argBuf.push_back ('\e');
+            argBuf.push_back (ch);
+            setState (InputState::OSC);
+            break;
+         }
+         break;
+      default:
+         unhandledInput (ch);
+         break;
+      }
+   }
 
    void
    Vterm::processInput (const std::string& str)
@@ -1005,387 +1514,128 @@ namespace zutty
       for (readPos = 0; readPos < inputSize; ++readPos)
       {
          const unsigned char& ch = input [readPos];
-         switch (inputState)
+         if (inputState != InputState::Normal)
          {
-         case InputState::Normal:
-            switch (ch)
+            const InputTransition& tr =
+               inputTable.at [(int) inputState][ch];
+            switch (tr.action)
             {
-            case '\x00': // ignore NUL
+            case InputAction::Ignore:
                break;
-            case '\e':
-               setState (compatLevel == CompatibilityLevel::VT52
-                         ? InputState::Escape_VT52
-                         : InputState::Escape);
-               inputOps [0] = 0;
-               nInputOps = 1;
-               lastEscBegin = readPos;
-               break;
-            case '\r': traceNormalInput (); inp_CR (); break;
-            case '\f': // fall through, treat as LineFeed ('\n')
-            case '\v': // fall through, treat as LineFeed ('\n')
-            case '\n': traceNormalInput (); esc_IND (); break;
-            case '\t': traceNormalInput (); inp_HT (); break;
-            case '\b': traceNormalInput (); csi_CUB (); break;
-            case '\a':
-               traceNormalInput ();
-               logI << "* Bell *" << std::endl;
-               break;
-            case '\x0e': traceNormalInput (); charsetState.gl = 1; break;
-            case '\x0f': traceNormalInput (); charsetState.gl = 0; break;
-            case '\x05': // ENQ - Enquiry
-               traceNormalInput ();
-               break;
-            default: inputGraphicChar (ch);
-            }
-            break;
-         case InputState::Escape_VT52:
-            switch (ch)
-            {
-            case '\x18': case '\x1a': // CAN and SUB interrupts ESC sequence
-               setState (InputState::Normal); break;
-            case '\e': // ESC restarts ESC sequence
-               inputOps [0] = 0;
-               nInputOps = 1;
-               lastEscBegin = readPos;
-               break;
-            case '=':
-               keypadMode = KeypadMode::Application;
-               setState (InputState::Normal);
-               break;
-            case '>':
-               keypadMode = KeypadMode::Normal;
-               setState (InputState::Normal);
-               break;
-            case '<':
-               compatLevel = CompatibilityLevel::VT100;
-               setState (InputState::Normal);
-               break;
-            case 'A': csi_CUU (); break;
-            case 'B': csi_CUD (); break;
-            case 'C': csi_CUF (); break;
-            case 'D': csi_CUB (); break;
-            case 'F':
-               charsetState = CharsetState {};
-               charsetState.g [charsetState.gl] = Charset::DecSpec;
-               setState (InputState::Normal);
-               break;
-            case 'G':
-               charsetState = CharsetState {};
-               setState (InputState::Normal);
-               break;
-            case 'H': csi_CUP (); break;
-            case 'I': esc_RI (); break;
-            case 'J': csi_ED (); break;
-            case 'K': csi_EL (); break;
-            case 'Y': setState (InputState::VT52_CUP_Arg1); break;
-            case 'Z': writePty ("\e/Z"); break;
-            case 'c': esc_RIS (); break; // allow "reset" command to escape VT52
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::VT52_CUP_Arg1:
-            inputOps [0] = input [readPos] - 31;
-            setState (InputState::VT52_CUP_Arg2);
-            break;
-         case InputState::VT52_CUP_Arg2:
-            inputOps [1] = input [readPos] - 31;
-            nInputOps = 2;
-            csi_CUP ();
-            break;
-         case InputState::Escape:
-            switch (ch)
-            {
-            case '\x18': case '\x1a': // CAN and SUB interrupts ESC sequence
-               setState (InputState::Normal);
+            case InputAction::Enter:
+               setState (tr.next);
                break;
-            case '\e': // ESC restarts ESC sequence
+            case InputAction::Restart:
                inputOps [0] = 0;
                nInputOps = 1;
                lastEscBegin = readPos;
                break;
-            case ' ': setState (InputState::Esc_SPC); break;
-            case '#': setState (InputState::Esc_Hash); break;
-            case '%': setState (InputState::Esc_Pct); break;
-            case '[': setState (InputState::CSI); break;
-            case ']': argBuf.clear (); setState (InputState::OSC); break;
-            case '(': case ')': case '*': case '+':
-            case '-': case '.': case '/':
-            case ',': case '$': // from ISO/IEC 2022 (absorbed, treat as no-op)
-               scsDst = ch;
-               scsMod = '\0';
-               setState (InputState::SelectCharset);
+            case InputAction::Unhandled:
+               unhandledInput (ch);
                break;
-            case 'D': esc_IND (); break;
-            case 'M': esc_RI (); break;
-            case 'E': esc_NEL (); break;
-            case 'H': esc_HTS (); break;
-            case 'N': charsetState.ss = 2; setState (InputState::Normal); break;
-            case 'O': charsetState.ss = 3; setState (InputState::Normal); break;
-            case 'P': argBuf.clear (); setState (InputState::DCS); break;
-            case 'c': esc_RIS (); break;
-            case '6': esc_BI (); break;
-            case '7': esc_DECSC (); break;
-            case '8': esc_DECRC (); break;
-            case '9': esc_FI (); break;
-            case '=':
-               keypadMode = KeypadMode::Application;
-               setState (InputState::Normal);
-               break;
-            case '>':
-               keypadMode = KeypadMode::Normal;
-               setState (InputState::Normal);
-               break;
-            case '<':
-               compatLevel = CompatibilityLevel::VT400;
-               setState (InputState::Normal);
-               break;
-            case '~': charsetState.gr = 1; setState (InputState::Normal); break;
-            case 'n': charsetState.gl = 2; setState (InputState::Normal); break;
-            case '}': charsetState.gr = 2; setState (InputState::Normal); break;
-            case 'o': charsetState.gl = 3; setState (InputState::Normal); break;
-            case '|': charsetState.gr = 3; setState (InputState::Normal); break;
-            case '\\': setState (InputState::Normal); break; // ignore lone ST
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::Esc_SPC:
-            switch (ch)
-            {
-            case 'F':
-               logU << "S7C1T: Send 7-bit controls" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case 'G':
-               logU << "S8C1T: Send 8-bit controls" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case 'L':
-               logU << "Set ANSI conformance level 1" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case 'M':
-               logU << "Set ANSI conformance level 2" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case 'N':
-               logU << "Set ANSI conformance level 3" << std::endl;
-               setState (InputState::Normal);
-               break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::Esc_Hash:
-            switch (ch)
-            {
-            case '3':
-               logU << "DECDHL: Double-height, top half" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case '4':
-               logU << "DECDHL: Double-height, bottom half" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case '5':
-               logU << "DECSWL: Single-width line" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case '6':
-               logU << "DECDWL: Double-width line" << std::endl;
-               setState (InputState::Normal);
-               break;
-            case '8': esch_DECALN (); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::Esc_Pct:
-            switch (ch)
-            {
-            case '@':
-               logT << "Select charset: default (ISO-8859-1)" << std::endl;
-               charsetState = CharsetState {};
-               charsetState.g [charsetState.gr] = Charset::IsoLatin1;
-               setState (InputState::Normal);
-               break;
-            case 'G':
-               logT << "Select charset: UTF-8" << std::endl;
-               charsetState = CharsetState {};
-               setState (InputState::Normal);
+            case InputAction::Execute:
+               switch (ch)
+               {
+               case '\t': inp_HT (); break;
+               case '\r': inp_CR (); break;
+               default: esc_IND (); break; // VT, FF
+               }
+               setState (tr.next); // as the above end any sequence
                break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::SelectCharset:
-            if (ch < 0x30) // intermediate
-               scsMod = ch;
-            else
-               esc_DCS (ch);
-            break;
-         case InputState::CSI:
-            switch (ch)
-            {
-            COLLECT_NUMERIC_PARAMS;
-            case '\e': setState (InputState::Normal); break;
-            case 'A': csi_CUU (); break;
-            case 'B': csi_CUD (); break;
-            case 'C': csi_CUF (); break;
-            case 'D': csi_CUB (); break;
-            case 'E': csi_CNL (); break;
-            case 'F': csi_CPL (); break;
-            case 'G': csi_CHA (); break;
-            case 'H': case 'f': csi_CUP (); break;
-            case 'I': csi_CHT (); break;
-            case 'J': csi_ED (); break;
-            case 'K': csi_EL (); break;
-            case 'L': csi_IL (); break;
-            case 'M': csi_DL (); break;
-            case 'P': csi_DCH (); break;
-            case 'S': csi_SU (); break;
-            case 'T': csi_SD (); break;
-            case 'X': csi_ECH (); break;
-            case 'Z': csi_CBT (); break;
-            case '@': csi_ICH (); break;
-            case '`': csi_HPA (); break;
-            case 'a': csi_HPR (); break;
-            case 'b': csi_REP (); break;
-            case 'c': csi_priDA (); break;
-            case 'd': csi_VPA (); break;
-            case 'e': csi_VPR (); break;
-            case 'g': csi_TBC (); break;
-            case 'h': csi_SM (); break;
-            case 'l': csi_RM (); break;
-            case 'm': csi_SGR (); break;
-            case 'n': csi_DSR (); break;
-            case 'r': csi_STBM (); break;
-            case 's': csi_SCOSC_SLRM (); break;
-            case 't': csi_XTWINOPS (); break;
-            case 'u': csi_SCORC (); break;
-            case '\'': setState (InputState::CSI_Quote); break;
-            case '\"': setState (InputState::CSI_DblQuote); break;
-            case '!': setState (InputState::CSI_Bang); break;
-            case '?': setState (InputState::CSI_priv); break;
-            case ' ': setState (InputState::CSI_SPC); break;
-            case '>': setState (InputState::CSI_GT); break;
-            case '\a': break; // ignore
-            case '\b': // undo last character in CSI sequence:
+            case InputAction::Undo: // undo last character in CSI sequence:
                if (readPos && input [readPos - 1] == ';')
                   --nInputOps;
                else
                   inputOps [nInputOps - 1] /= 10;
                break;
-            case '\t': inp_HT (); setState (InputState::CSI); break;
-            case '\r': inp_CR (); setState (InputState::CSI); break;
-            case '\f': // fall through
-            case '\v': esc_IND (); setState (InputState::CSI); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::CSI_Bang:
-            switch (ch)
-            {
-            case 'p': csi_DECSTR (); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::CSI_Quote:
-            switch (ch)
-            {
-            case '}': csi_DECIC (); break;
-            case '~': csi_DECDC (); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::CSI_DblQuote:
-            switch (ch)
-            {
-            case 'p': csiq_DECSCL (); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::CSI_SPC:
-            switch (ch)
-            {
-            case '@': csi_ecma48_SL (); break;
-            case 'A': csi_ecma48_SR (); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::CSI_GT:
-            switch (ch)
-            {
-            COLLECT_NUMERIC_PARAMS;
-            case 'c': csi_secDA (); break;
-            case 'm': csi_XTMODKEYS (); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::CSI_priv:
-            switch (ch)
-            {
-            COLLECT_NUMERIC_PARAMS;
-            case '\e': setState (InputState::Normal); break;
-            case 'h': csi_privSM (); break;
-            case 'l': csi_privRM (); break;
-            default: unhandledInput (ch); break;
-            }
-            break;
-         case InputState::DCS:
-            switch (ch)
-            {
-            case '\e': setState (InputState::DCS_Esc); break;
-            default:
+            case InputAction::Param:
+               collectNumericParams (input, inputSize);
+               break;
+            case InputAction::Collect:
+               scsMod = ch;
+               break;
+            case InputAction::Put:
                if (argBuf.size () < 4095)
                   argBuf.push_back (ch);
                else
                {
-                  logE << "DCS argument string overflow" << std::endl;
+                  logE << (inputState == InputState::DCS ? "DCS" : "OSC")
+                       << " argument string overflow" << std::endl;
                   setState (InputState::Normal);
                }
                break;
-            }
-            break;
-         case InputState::DCS_Esc:
-            switch (ch)
+            case InputAction::CsiDispatch:
             {
-            case '\\': handle_DCS (); break;
-            default:
-               argBuf.push_back ('\e');
-               argBuf.push_back (ch);
-               setState (InputState::DCS);
+               const CsiHandlerFn fn = csiHandlers [ch - '@'];
+               if (fn)
+                  (this->*fn) ();
+               else
+                  unhandledInput (ch);
                break;
             }
-            break;
-         case InputState::OSC:
-            switch (ch)
-            {
-            case '\a': handle_OSC (); break;
-            case '\e': setState (InputState::OSC_Esc); break;
-            default:
-               if (argBuf.size () < 4095)
-                  argBuf.push_back (ch);
-               else
-               {
-                  logE << "OSC argument string overflow" << std::endl;
-                  setState (InputState::Normal);
-               }
+            case InputAction::Dispatch:
+               dispatchInput (ch);
                break;
             }
+            continue;
+         }
+
+         switch (ch)
+         {
+         case '\x00': // ignore NUL
             break;
-         case InputState::OSC_Esc:
-            switch (ch)
+         case '\e':
+            setState (compatLevel == CompatibilityLevel::VT52
+                      ? InputState::Escape_VT52
+                      : InputState::Escape);
+            inputOps [0] = 0;
+            nInputOps = 1;
+            lastEscBegin = readPos;
+            break;
+         case '\r': traceNormalInput (); inp_CR (); break;
+         case '\f': // fall through, treat as LineFeed ('\n')
+         case '\v': // fall through, treat as LineFeed ('\n')
+         case '\n':
+            traceNormalInput ();
+            if (canScrollLineFeeds ())
+               readPos += scrollLineFeeds (input + readPos,
+                                           input + inputSize) - 1;
+            else
+               esc_IND ();
+            break;
+         case '\t': traceNormalInput (); inp_HT (); break;
+         case '\b': traceNormalInput (); csi_CUB (); break;
+         case '\a':
+            traceNormalInput ();
+            logI << "* Bell *" << std::endl;
+            break;
+         case '\x0e': traceNormalInput (); charsetState.gl = 1; break;
+         case '\x0f': traceNormalInput (); charsetState.gl = 0; break;
+         case '\x05': // ENQ - Enquiry
+            traceNormalInput ();
+            break;
+         default:
+            if (ch >= 0x20 && ch < 0x7f)
             {
-            case '\\': handle_OSC (); break;
-            default:
-               argBuf.push_back ('\e');
-               argBuf.push_back (ch);
-               setState (InputState::OSC);
-               break;
+               utf8dec.checkPrematureEOS ();
+               if (canPlaceAsciiRun ())
+               {
+                  int len = printableAsciiRun (input + readPos,
+                                               input + inputSize);
+                  placeAsciiRun (input + readPos, len);
+                  readPos += len - 1;
+                  break;
+               }
             }
-            break;
+            inputGraphicChar (ch);
          }
       }
       traceNormalInput ();
       showCursor ();
-      redraw ();
+      if (deferRefresh || syncUpdate)
+         refreshPending = true;
+      else
+         redraw ();
    }
 
    void
@@ -1535,15 +1785,15 @@ namespace zutty
       redraw ();
    }
 
-   bool
-   Vterm::selectFinish (std::string& utf8_selection)
+   Frame::SelectionReader
+   Vterm::selectFinish ()
    {
       logT << "selectFinish ()" << std::endl;
 
       showCursor ();
       redraw ();
 
-      return  cf->getSelectedUtf8 (utf8_selection);
+      return cf->readSelection ();
    }
 
    void
@@ -1562,9 +1812,43 @@ namespace zutty
       redraw ();
    }
 
+   bool
+   Vterm::search (const std::string& utf8_query, bool older, bool skipCurrent)
+   {
+      logT << "search ('" << utf8_query << "'), older=" << older
+           << ", skipCurrent=" << skipCurrent << std::endl;
+
+      std::vector <uint16_t> query;
+      auto sink = [&query] (uint32_t cp)
+                  {
+                     query.push_back (internCodepoint (cp));
+                  };
+      Utf8Decoder <decltype (sink)> decoder (std::move (sink));
+      for (const unsigned char ch: utf8_query)
+         if (ch < 0x80)
+            query.push_back (ch);
+         else
+            decoder.pushByte (ch);
+
+      const bool found = cf->search (query, older, skipCurrent);
+      if (found)
+         redraw ();
+      return found;
+   }
+
    void
    Vterm::pasteSelection (const std::string& utf8_selection)
    {
+      if (outputPending > Max_Pending_Paste)
+      {
+         logW << "Paste refused: " << outputPending
+              << " bytes of earlier output not yet taken by the child"
+              << std::endl;
+         return;
+      }
+
+      // The paste is queued in one piece (with its brackets, if any), so
+      // other output can only be queued before or after it, never inside.
       std::ostringstream oss;
 
       if (bracketedPasteMode)
@@ -14,9 +14,12 @@
 #include "frame.h"
 #include "utf8.h"
 
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <string>
 
 namespace zutty
 {
@@ -82,7 +85,7 @@ namespace zutty
              uint16_t winPx, uint16_t winPy,
              int ptyFd);
 
-      ~Vterm () = default;
+      ~Vterm ();
 
       using RefreshHandlerFn = std::function <void (const Frame&)>;
       void setRefreshHandler (const RefreshHandlerFn&);
@@ -115,6 +118,19 @@ namespace zutty
 
       bool readPty ();
 
+      // Output to the pty that the child has not taken yet is queued, and
+      // written out by flushOutput () once the pty becomes writable.
+      bool hasPendingOutput () const;
+      void flushOutput ();
+
+      // Refreshes deferred by readPty () under heavy output: the time in ms
+      // until one is due (-1 if none is pending), and performing it if due.
+      int getRefreshTimeout () const;
+      void flushRefresh ();
+
+      // Process a chunk of output from the pty, as read by readPty ()
+      void processInput (const unsigned char *const input, int size);
+
       const MouseTrackingState& getMouseTrackingState () const;
 
       void setHasFocus (bool);
@@ -126,19 +142,23 @@ namespace zutty
       void selectStart (int pX, int pY, bool cycleSnapTo);
       void selectExtend (int pX, int pY, bool cycleSnapTo);
       void selectUpdate (int pX, int pY);
-      bool selectFinish (std::string& utf8_selection);
+      Frame::SelectionReader selectFinish ();
       void selectClear ();
       void selectRectangularModeToggle ();
 
+      // Search for the next match of (UTF-8) query; see Frame::search
+      bool search (const std::string& utf8_query,
+                   bool older, bool skipCurrent);
+
       void pasteSelection (const std::string& utf8_selection);
 
    private:
       std::string getLocalEcho (const unsigned char *const begin,
                                 const unsigned char *const end);
-      void processInput (const unsigned char *const input, int size);
       void processInput (const std::string& str);
 
       int writePty (const uint8_t* ucstr, size_t len, bool userInput = false);
+      int queueOutput (const uint8_t* ucstr, size_t len);
 
       // table entry for deciding which set of InputSpecs to use
       struct InputSpecTable
@@ -227,10 +247,18 @@ namespace zutty
       void showCursor ();
       void hideCursor ();
       void inputGraphicChar (unsigned char ch);
-      void placeGraphicChar ();
+      void placeGraphicChar (uint32_t pt);
+      bool canPlaceAsciiRun () const;
+      void placeAsciiRun (const unsigned char* text, int count);
+      bool canScrollLineFeeds () const;
+      int scrollLineFeeds (const unsigned char* begin,
+                           const unsigned char* end);
       void jumpToNextTabStop ();
       void setFgFromPalIx ();
       void setBgFromPalIx ();
+      void internAttrColors ();
+      void markColors (std::vector <bool>& used) const;
+      void resolveAttrColors ();
 
       // DEC control sequence handlers, prefixed with input state
       void inp_LF ();        // Line Feed
@@ -303,6 +331,90 @@ namespace zutty
       void csi_XTWINOPS ();  // Xterm window operations
       void csi_XTMODKEYS (); // Xterm key modifier options
 
+      using CsiHandlerFn = void (Vterm::*) ();
+      static const CsiHandlerFn csiHandlers [];
+      void collectNumericParams (const unsigned char *const input,
+                                 int inputSize);
+
+      // Escape sequences are parsed after the DEC parser model of Paul
+      // Williams: the class of each byte is looked up, in the table row
+      // of the current input state, for what to do and which state to go
+      // to next. Bytes of a meaning particular to the state (e.g., final
+      // bytes selecting a function) are passed on to dispatchInput. The
+      // table is generated at compile time, and expanded to be indexed by
+      // the bytes themselves, saving a lookup of their class per byte.
+      enum class ByteClass: uint8_t
+      {
+         Control,      // C0 controls not listed below (e.g., LF)
+         Cancel,       // CAN, SUB
+         Escape,       // ESC
+         Bell,         // BEL
+         Backspace,    // BS
+         Format,       // HT, VT, FF, CR
+         Intermediate, // ' ' to '/'
+         Param,        // digits and ';'
+         Colon,        // ':'
+         Private,      // '<' to '?'
+         Final,        // '@' to '~'
+         Delete,       // DEL
+         High,         // 0x80 and above
+         N_Classes
+      };
+
+      enum class InputAction: uint8_t
+      {
+         Ignore,      // skip the byte
+         Enter,       // go to the next state
+         Restart,     // start the escape sequence anew (on ESC)
+         Unhandled,   // report the byte, abandoning the sequence
+         Execute,     // act on a format effector within a CSI sequence
+         Undo,        // take back the last parameter byte (on BS)
+         Param,       // accumulate numeric parameters
+         Collect,     // take the intermediate of a charset designation
+         Put,         // append to the argument string (of DCS or OSC)
+         CsiDispatch, // look up the final byte in csiHandlers
+         Dispatch     // see dispatchInput
+      };
+
+      struct InputTransition
+      {
+         InputAction action;
+         InputState next; // for InputAction::Enter
+      };
+
+      constexpr const static int nInputStates =
+         (int) InputState::VT52_CUP_Arg2 + 1;
+      constexpr const static int nByteClasses = (int) ByteClass::N_Classes;
+
+      struct ByteClasses
+      {
+         ByteClass of [256];
+      };
+      struct InputTransitions
+      {
+         InputTransition at [nInputStates][nByteClasses];
+      };
+
+      constexpr static ByteClasses makeByteClasses ();
+      constexpr static void setTransitions (InputTransitions& t,
+                                            InputState state,
+                                            InputAction action,
+                                            InputState next);
+      constexpr static void setTransition (InputTransitions& t,
+                                           InputState state, ByteClass cls,
+                                           InputAction action,
+                                           InputState next);
+      constexpr static InputTransitions makeInputTransitions ();
+
+      struct InputTable
+      {
+         InputTransition at [nInputStates][256];
+      };
+      constexpr static InputTable makeInputTable ();
+      static const InputTable inputTable;
+
+      void dispatchInput (unsigned char ch);
+
       void dcs_DECRQSS (const std::string&); // DEC Request Status String
 
       void osc_PaletteQuery (int, const std::string&);
@@ -316,7 +428,25 @@ namespace zutty
       uint16_t glyphPy;
       int ptyFd;
 
+      // Pty output not yet written, oldest first; outputHead is the offset
+      // of the first unwritten byte of the front chunk.
+      std::deque <std::string> outputQueue;
+      size_t outputHead = 0;
+      size_t outputPending = 0;
+
       RefreshHandlerFn onRefresh;
+      std::chrono::steady_clock::time_point lastRefresh;
+      bool deferRefresh = false;
+      bool refreshPending = false;
+
+      // Synchronized update (private mode 2026, or DCS =1s ... =2s): hold
+      // back refreshes until the application has finished drawing, but
+      // not for longer than syncUpdateTimeout.
+      void setSyncUpdate (bool on);
+      bool syncUpdate = false;
+      std::chrono::steady_clock::time_point syncUpdateStart;
+      constexpr const static std::chrono::milliseconds::rep
+         syncUpdateTimeout = 150; // ms
       OscHandlerFn onOsc;
       bool haveOscHandler = false;
 
@@ -332,8 +462,10 @@ namespace zutty
       bool lastCol = false;
 
       CharVdev::Cell attrs;   // prototype cell with current attributes
-      Color* fg = &attrs.fg;
-      Color* bg = &attrs.bg;
+      Color attrFg;           // colors of attrs (as codes in attrs itself)
+      Color attrBg;
+      Color* fg = &attrFg;
+      Color* bg = &attrBg;
       Color palette256 [256];
       int defaultFgPalIx; // if -1, set from opts.fg, else idx into palette256
       int defaultBgPalIx; // if -1, set from opts.bg, else idx into palette256
@@ -352,7 +484,12 @@ namespace zutty
       constexpr const static size_t maxEscOps = 16;
       uint32_t inputOps [maxEscOps];
       size_t nInputOps = 0;
-      Utf8Decoder utf8dec;
+      struct GraphicCharSink
+      {
+         Vterm* vt;
+         void operator () (uint32_t pt) { vt->placeGraphicChar (pt); }
+      };
+      Utf8Decoder <GraphicCharSink> utf8dec;
       std::vector <unsigned char> argBuf;
       unsigned char scsDst;  // Select charset / destination designator
       unsigned char scsMod;  // Select charset / selector (intermediate)
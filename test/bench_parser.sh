@@ -0,0 +1,14 @@
+#!/usr/bin/env bash
+
+# Headless benchmark of the input parser: needs neither X11 nor a GPU,
+# so it can be run on build hosts as part of CI.
+
+cd $(dirname $0)
+
+BENCH=${BENCH:-../build/src/zutty-bench}
+if [ ! -x ${BENCH} ] ; then
+    echo "${BENCH} not found; build Zutty first (or set BENCH)."
+    exit 1
+fi
+
+${BENCH} ${REPS:-10} vtscript.gz UTF-8-test.txt @sgr
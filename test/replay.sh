@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+
+# Cell-level check of pty sessions recorded with zutty -record: each
+# recording is replayed headless, and the checksum of the sequence of
+# screens after each refresh is compared to the reference given for it.
+# Like bench_parser.sh, this needs neither X11 nor a GPU.
+#
+# Usage: replay.sh <recording> <checksum> [<recording> <checksum> ...]
+# (a checksum of - only prints the one obtained, to use as reference)
+
+BENCH=${BENCH:-"$(dirname "$0")/../build/src/zutty-bench"}
+if [ ! -x "${BENCH}" ] ; then
+    echo "${BENCH} not found; build Zutty first (or set BENCH)."
+    exit 1
+fi
+
+# Character widths depend on the locale, so replay in a fixed one
+export LC_ALL=C.UTF-8
+
+EXIT_CODE=0
+while [ $# -ge 2 ] ; do
+    rec="$1"; ref="$2"; shift 2
+    frames=$("${BENCH}" -hashes 1 "${rec}" | grep "^frame")
+    sig=$(echo "${frames}" | cksum | awk '{print $1}')
+    if [ -z "${frames}" ] ; then
+        echo "${rec}: ERROR (no frames replayed)"
+        EXIT_CODE=1
+    elif [ "${ref}" == "-" ] ; then
+        echo "${rec}: ${sig}"
+    elif [ "${sig}" == "${ref}" ] ; then
+        echo "${rec}: OK"
+    else
+        echo "${rec}: FAIL sig ${sig} ref ${ref}"
+        EXIT_CODE=1
+    fi
+done
+exit ${EXIT_CODE}
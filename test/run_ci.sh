@@ -8,7 +8,7 @@ echo "Running all automated tests with --ci-mode $@ ..." && \
     ./scrollback.sh --ci-mode $@ && \
     ./title.sh --ci-mode $@ && \
     ./truecolor.sh --ci-mode $@ && \
-    ./utf8.sh --ci-mode $@ && \
+    ./replay.sh utf8.zrec 3155518903 && \
     ./vttest.sh --ci-mode $@ && \
     ./wraptest.sh --ci-mode $@ && \
     echo "All tests ran successfully, no errors detected!"